@@ -0,0 +1,222 @@
+/*
+ * File:   bench.c
+ * Per-message cost of the firmware hot paths, measured on the host build.
+ *
+ * Usage: bench [iterations]
+ *
+ * Every row reports wall time and retired user-space instructions per unit.
+ * Instruction counts come from perf_event_open and are reported as n/a when
+ * the kernel does not allow it (e.g. inside containers).
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <xc.h>
+#include "hal.h"
+#include "../pragmas.h"
+#include "../main.h"
+
+/* Bytes fed into INBUF before each parse(), as many as it holds */
+#define RX_BATCH INBUF_MASK
+/* Frames queued before OUTBUF is drained, as many of the longest as it holds */
+#define TX_BATCH (OUTBUF_MASK / FRAME_MAX_LENGTH)
+
+/* Command mix the simulator sends during a flight, END excluded */
+static const char *stream =
+        "$SPD000A#$ALT00C8#$LED01#$MAN01#$SPD000A#$LED00#$ALT0000#$MAN00#";
+
+typedef struct {
+    struct timespec t0;
+    long long i0;
+    long long ns;
+    long long instructions;
+} meter_t;
+
+static int perf_fd = -1;
+
+static void perf_open(void) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof (attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof (attr);
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    perf_fd = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (perf_fd >= 0) {
+        ioctl(perf_fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+static long long perf_read(void) {
+    long long count = 0;
+    if (perf_fd < 0 || read(perf_fd, &count, sizeof (count)) != sizeof (count))
+        return -1;
+    return count;
+}
+
+static void meter_start(meter_t *m) {
+    m->i0 = perf_read();
+    clock_gettime(CLOCK_MONOTONIC, &m->t0);
+}
+
+static void meter_stop(meter_t *m) {
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    long long i1 = perf_read();
+    m->ns += (t1.tv_sec - m->t0.tv_sec) * 1000000000LL + (t1.tv_nsec - m->t0.tv_nsec);
+    if (m->i0 >= 0 && i1 >= 0) m->instructions += i1 - m->i0;
+    else m->instructions = -1;
+}
+
+static void report(const char *name, const meter_t *m, long long units, const char *unit) {
+    printf("%-22s %10.1f ns", name, (double) m->ns / units);
+    if (m->instructions >= 0)
+        printf(" %10.1f instr", (double) m->instructions / units);
+    else
+        printf(" %16s", "n/a instr");
+    printf("  per %s (%lld)\n", unit, units);
+}
+
+/* Flight state every benchmark starts from: GO received, timer running */
+static void boot_flight(void) {
+    host_boot();
+    host_uart_tx_clear();
+    get_go(AIRCRAFT, 0xFFFF);
+    get_speed(AIRCRAFT, 1);
+}
+
+static void bench_parse(long iterations) {
+    meter_t rx = {0}, prs = {0};
+    size_t len = strlen(stream), pos = 0;
+    long long bytes = 0;
+
+    boot_flight();
+    for (long i = 0; i < iterations; i++) {
+        meter_start(&rx);
+        for (int b = 0; b < RX_BATCH; b++) {
+            host_uart_rx((uint8_t) stream[pos]);
+            if (++pos == len) pos = 0;
+        }
+        meter_stop(&rx);
+
+        meter_start(&prs);
+        parse(AIRCRAFT);
+        meter_stop(&prs);
+        bytes += RX_BATCH;
+    }
+    report("receive_isr", &rx, bytes, "byte");
+    report("parse", &prs, bytes, "byte");
+}
+
+static void bench_encode(const char *name, int kind, long iterations) {
+    meter_t enc = {0}, tx = {0};
+    long long frames = 0, bytes = 0;
+    uint8_t sink[256];
+
+    boot_flight();
+    get_binary(AIRCRAFT, kind == 3);
+    for (long i = 0; i < iterations; i++) {
+        meter_start(&enc);
+        for (int f = 0; f < TX_BATCH; f++) {
+            switch (kind) {
+                case 0:
+                case 3: send_distance(AIRCRAFT, (uint16_t) (i + f));
+                    break;
+                case 1: send_altitude(AIRCRAFT, (uint16_t) ((i + f) & 0x3FF));
+                    break;
+                default: send_button_press(AIRCRAFT, (uint8_t) (4 + (f & 3)));
+                    break;
+            }
+        }
+        meter_stop(&enc);
+        frames += TX_BATCH;
+
+        meter_start(&tx);
+        host_service_interrupts();
+        meter_stop(&tx);
+        size_t n;
+        while ((n = host_uart_tx_take(sink, sizeof (sink))) > 0) bytes += n;
+    }
+    report(name, &enc, frames, "frame");
+    if (kind == 0) report("transmit_isr", &tx, bytes, "byte");
+    if (kind == 3) printf("%-22s %10.1f bytes per frame\n", "binary DST", (double) bytes / frames);
+}
+
+static void bench_tick(long iterations) {
+    meter_t tick = {0}, task = {0};
+    long long ticks = 0;
+
+    boot_flight();
+    get_altitude(AIRCRAFT, 400);
+    host_adc_set_input(600);
+    for (long i = 0; i < iterations; i++) {
+        host_adc_step(); /* Complete the conversion started by the last tick */
+        meter_start(&tick);
+        for (int t = 0; t < TX_BATCH * TIMEBASE_EVENTS_PER_TICK; t++) {
+            TIMEBASE_IF = 1;
+            timer_isr(AIRCRAFT);
+        }
+        meter_stop(&tick);
+
+        meter_start(&task);
+        telemetry_task(AIRCRAFT);
+        meter_stop(&task);
+        ticks += TX_BATCH;
+        host_service_interrupts();
+        host_uart_tx_clear();
+    }
+    report("timer_isr", &tick, ticks, "tick");
+    report("telemetry_task", &task, ticks, "tick");
+}
+
+static void bench_debounce(long iterations) {
+    meter_t smp = {0};
+    long long samples = 0;
+
+    boot_flight();
+    get_manual(AIRCRAFT, 1);
+    for (uint8_t led = 1; led <= 4; led++) get_led(AIRCRAFT, led);
+    for (long i = 0; i < iterations; i++) {
+        // A press and a release of all buttons, each bouncing for a few samples
+        host_portb_write((i & 32) ? 0x0F : (uint8_t) (i & 0x0F));
+        meter_start(&smp);
+        for (int t = 0; t < TX_BATCH; t++) {
+            PIR1bits.TMR2IF = 1;
+            debounce_isr(AIRCRAFT);
+        }
+        meter_stop(&smp);
+        samples += TX_BATCH;
+        AIRCRAFT->portb_send = 0;
+    }
+    report("debounce_isr", &smp, samples, "sample");
+}
+
+int main(int argc, char **argv) {
+    long iterations = argc > 1 ? strtol(argv[1], NULL, 10) : 20000;
+    if (iterations <= 0) {
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    perf_open();
+    printf("%ld iterations, instruction counter %s\n", iterations,
+            perf_fd >= 0 ? "enabled" : "unavailable");
+
+    bench_parse(iterations);
+    bench_encode("send_distance", 0, iterations);
+    bench_encode("send_altitude", 1, iterations);
+    bench_encode("send_button_press", 2, iterations);
+    bench_encode("send_distance binary", 3, iterations);
+    bench_tick(iterations);
+    bench_debounce(iterations);
+    return 0;
+}
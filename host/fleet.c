@@ -0,0 +1,209 @@
+/*
+ * File:   fleet.c
+ * Many independent aircraft in one process.
+ *
+ * Usage: fleet [-n aircraft] [-t threads] [-s ticks]
+ *
+ * Every aircraft is a board of its own (host_board_new()) running main.c's
+ * ISRs and main loop iteration. The boards are split into one contiguous shard
+ * per worker thread, and each thread steps its shard a tick at a time: the
+ * timebase and the ADC fire, host_service_tasks() runs and the frames the
+ * board sent are checked against a model of the flight.
+ *
+ * Each aircraft is flown by a scripted ground station: GOO with a distance,
+ * SPD and ALT chosen from its index, then END once the distance reaches 0,
+ * after which the next flight starts right away. Every DST must carry the
+ * modelled distance and ALT must come exactly every altitude period. Defaults
+ * are 1000 aircraft, one thread per CPU and 1000 ticks (100 s of flight).
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <xc.h>
+#include "hal.h"
+#include "../pragmas.h"
+#include "../main.h"
+
+#define MAX_THREADS 256
+#define MAX_REPORTED_ERRORS 10  /* Per thread, the rest are only counted */
+
+typedef struct {
+    host_board_t *board;
+    unsigned index;
+    uint16_t dist; /* Modelled distance */
+    uint16_t speed;
+    uint8_t altitude_period; /* Ticks between ALT frames, 0 for none */
+    uint8_t counter; /* Ticks since the last ALT frame */
+} aircraft_model_t;
+
+typedef struct {
+    pthread_t thread;
+    aircraft_model_t *models;
+    unsigned count;
+    unsigned ticks;
+    unsigned long frames;
+    unsigned long flights;
+    unsigned long errors;
+} shard_t;
+
+static unsigned long now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (unsigned long) t.tv_sec * 1000000000UL + (unsigned long) t.tv_nsec;
+}
+
+static void receive(const char *frame) {
+    for (const char *c = frame; *c; c++) host_uart_rx((uint8_t) *c);
+    host_service_tasks();
+}
+
+/* Sends the commands of the next flight to the selected board */
+static void start_flight(aircraft_model_t *m) {
+    static const uint16_t periods_ms[] = {0, 200, 400, 600};
+    char frame[16];
+    m->dist = (uint16_t) (0x400 + (m->index * 97) % 0x1000);
+    m->speed = (uint16_t) (8 + m->index % 32);
+    m->altitude_period = (uint8_t) (periods_ms[m->index % 4] / TICK_PERIOD_MS);
+    m->counter = 0;
+    snprintf(frame, sizeof (frame), "$GOO%04X#", m->dist);
+    receive(frame);
+    snprintf(frame, sizeof (frame), "$SPD%04X#", m->speed);
+    receive(frame);
+    snprintf(frame, sizeof (frame), "$ALT%04X#", periods_ms[m->index % 4]);
+    receive(frame);
+}
+
+static void report_error(shard_t *shard, const aircraft_model_t *m, const char *what, const char *frame) {
+    if (shard->errors++ < MAX_REPORTED_ERRORS)
+        fprintf(stderr, "fleet: aircraft %u: %s, got '%s'\n", m->index, what, frame);
+}
+
+/* Checks one frame the board sent on a tick against the model */
+static void check_frame(shard_t *shard, aircraft_model_t *m, const char *frame) {
+    char expected[16];
+    shard->frames++;
+    if (m->altitude_period != 0 && m->counter == m->altitude_period) {
+        if (strncmp(frame, "$ALT", 4) != 0) report_error(shard, m, "ALT expected", frame);
+        m->counter = 0;
+        return;
+    }
+    snprintf(expected, sizeof (expected), "$DST%04X#", m->dist);
+    if (strcmp(frame, expected) != 0) report_error(shard, m, expected, frame);
+}
+
+/* One tick of the selected board */
+static void step(shard_t *shard, aircraft_model_t *m) {
+    uint8_t out[64];
+    char frame[16];
+    size_t n, length = 0, frames = 0;
+
+    host_timer_tick();
+    host_adc_step();
+    host_service_tasks();
+    host_service_interrupts();
+
+    m->dist = m->dist >= m->speed ? m->dist - m->speed : 0;
+    m->counter++;
+    while ((n = host_uart_tx_take(out, sizeof (out))) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            if (out[i] == '$') length = 0;
+            if (length < sizeof (frame) - 1) frame[length++] = (char) out[i];
+            if (out[i] == '#') {
+                frame[length] = '\0';
+                check_frame(shard, m, frame);
+                frames++;
+            }
+        }
+    }
+    if (frames != 1) report_error(shard, m, "one frame per tick expected", frames ? frame : "");
+
+    if (m->dist == 0) {
+        receive("$END#");
+        shard->flights++;
+        start_flight(m);
+    }
+}
+
+static void *run_shard(void *arg) {
+    shard_t *shard = arg;
+    // Boards are allocated by the thread that runs them, so they stay in its memory
+    for (unsigned i = 0; i < shard->count; i++) {
+        aircraft_model_t *m = &shard->models[i];
+        m->board = host_board_new();
+        if (!m->board) {
+            perror("fleet: board");
+            exit(1);
+        }
+        host_select(m->board);
+        host_boot();
+        host_adc_set_input((uint16_t) (m->index * 37 % 1024));
+        start_flight(m);
+    }
+    for (unsigned t = 0; t < shard->ticks; t++) {
+        for (unsigned i = 0; i < shard->count; i++) {
+            host_select(shard->models[i].board);
+            step(shard, &shard->models[i]);
+        }
+    }
+    for (unsigned i = 0; i < shard->count; i++) host_board_free(shard->models[i].board);
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    unsigned aircraft = 1000, ticks = 1000;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:t:s:")) != -1) {
+        switch (opt) {
+            case 'n': aircraft = (unsigned) strtoul(optarg, NULL, 10);
+                break;
+            case 't': threads = strtol(optarg, NULL, 10);
+                break;
+            case 's': ticks = (unsigned) strtoul(optarg, NULL, 10);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-n aircraft] [-t threads] [-s ticks]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (threads < 1) threads = 1;
+    if (threads > MAX_THREADS) threads = MAX_THREADS;
+    if (threads > (long) aircraft) threads = aircraft ? (long) aircraft : 1;
+
+    static shard_t shards[MAX_THREADS];
+    aircraft_model_t *models = calloc(aircraft ? aircraft : 1, sizeof (aircraft_model_t));
+    for (unsigned i = 0; i < aircraft; i++) models[i].index = i;
+
+    unsigned long start = now_ns();
+    for (long s = 0, first = 0; s < threads; s++) {
+        unsigned count = (unsigned) ((aircraft * (s + 1)) / threads - first);
+        shards[s] = (shard_t){.models = models + first, .count = count, .ticks = ticks};
+        first += count;
+        if (pthread_create(&shards[s].thread, NULL, run_shard, &shards[s]) != 0) {
+            perror("fleet: thread");
+            return 1;
+        }
+    }
+    unsigned long frames = 0, flights = 0, errors = 0;
+    for (long s = 0; s < threads; s++) {
+        pthread_join(shards[s].thread, NULL);
+        frames += shards[s].frames;
+        flights += shards[s].flights;
+        errors += shards[s].errors;
+    }
+    double seconds = (now_ns() - start) / 1e9;
+
+    double aircraft_ticks = (double) aircraft * ticks;
+    printf("%u aircraft, %ld threads, %u ticks each\n", aircraft, threads, ticks);
+    printf("%lu frames, %lu flights completed, %lu errors\n", frames, flights, errors);
+    printf("%.3f s, %.0f aircraft-ticks/s, %.0f s of flight per second\n", seconds,
+            aircraft_ticks / seconds, aircraft_ticks * TICK_PERIOD_MS / 1000.0 / seconds);
+    free(models);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,285 @@
+/*
+ * File:   hal.c
+ * Host peripheral model for running main.c natively. See hal.h.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <xc.h>
+#include "hal.h"
+#include "../pragmas.h"
+#include "../main.h"
+
+/* Out-of-range TXREG1 value meaning "no byte loaded" */
+#define TXREG_EMPTY 0xFFFF
+
+#define TX_CAPTURE_SIZE 4096
+
+/* One aircraft and the peripherals it runs on */
+struct host_board {
+    host_sfr_t sfr;
+    aircraft_t aircraft;
+
+    uint8_t tx_capture[TX_CAPTURE_SIZE];
+    size_t tx_capture_len;
+
+    uint16_t adc_input;
+
+    /* Time since the last timebase event and TIMER2 period, see host_elapse_us() */
+    unsigned long timebase_elapsed_us;
+    unsigned long timer2_elapsed_us;
+};
+
+/* Selected until a thread calls host_select(). It is a single board for the
+ * whole process, so threads that run concurrently must select their own. */
+static host_board_t default_board;
+
+static _Thread_local host_board_t *board = &default_board;
+_Thread_local volatile host_sfr_t *host_sfr_current = &default_board.sfr;
+
+_Thread_local unsigned long host_reset_count = 0;
+_Thread_local unsigned long host_sleep_count = 0;
+
+/* **** Boards **** */
+
+host_board_t *host_board_new(void) {
+    return calloc(1, sizeof (host_board_t));
+}
+
+void host_board_free(host_board_t *b) {
+    if (b == board) host_select(NULL);
+    free(b);
+}
+
+void host_select(host_board_t *b) {
+    board = b ? b : &default_board;
+    host_sfr_current = &board->sfr;
+}
+
+aircraft_t *host_aircraft(void) {
+    return &board->aircraft;
+}
+
+void host_service_tasks(void) {
+    service_tasks(&board->aircraft);
+}
+
+uint8_t host_events_pending(void) {
+    return board->aircraft.events;
+}
+
+/* **** Intrinsics used by the firmware **** */
+
+/* Host code runs to completion, there is nothing to wait for */
+void host_sleep(void) {
+    host_sleep_count++;
+}
+
+/* The device restarts from main(); here the SFRs are cleared and the
+ * initialization sequence is run again before control returns */
+void host_reset(void) {
+    host_reset_count++;
+    host_boot();
+}
+
+/* **** Interrupt dispatch **** */
+
+/* The transmitter is modelled as infinitely fast: TXREG1 is always empty
+ * and the shift register always idle while TXEN is set */
+static void update_tx_flags(void) {
+    TXSTA1bits.TRMT = 1;
+    PIR1bits.TX1IF = TXSTA1bits.TXEN;
+}
+
+/* Interrupt sources: flag, enable, priority (1 = high), peripheral (needs PEIE
+ * when priorities are off). Returns 1 if an enabled interrupt of the given
+ * priority is pending. With IPEN = 0 every source is high priority. */
+static uint8_t is_pending(uint8_t high) {
+    struct {
+        uint8_t flag, enable, priority, peripheral;
+    } sources[] = {
+        {INTCONbits.TMR0IF, INTCONbits.TMR0IE, INTCON2bits.TMR0IP, 0},
+        {INTCONbits.RBIF, INTCONbits.RBIE, INTCON2bits.RBIP, 0},
+        {PIR1bits.RC1IF, PIE1bits.RC1IE, IPR1bits.RC1IP, 1},
+        {PIR1bits.TX1IF, PIE1bits.TX1IE, IPR1bits.TX1IP, 1},
+        {PIR1bits.ADIF, PIE1bits.ADIE, IPR1bits.ADIP, 1},
+        {PIR1bits.CCP1IF, PIE1bits.CCP1IE, IPR1bits.CCP1IP, 1},
+        {PIR1bits.TMR2IF, PIE1bits.TMR2IE, IPR1bits.TMR2IP, 1},
+    };
+    for (size_t i = 0; i < sizeof (sources) / sizeof (sources[0]); i++) {
+        uint8_t priority = RCONbits.IPEN ? sources[i].priority : 1;
+        if (!sources[i].flag || !sources[i].enable || priority != high) continue;
+        if (!RCONbits.IPEN && sources[i].peripheral && !INTCONbits.PEIE) continue;
+        return 1;
+    }
+    return 0;
+}
+
+/* Calls one vector and captures the byte it loaded into TXREG1, if any */
+static void dispatch(void (*isr)(void)) {
+    TXREG1 = TXREG_EMPTY;
+    isr();
+    if (TXREG1 != TXREG_EMPTY && board->tx_capture_len < TX_CAPTURE_SIZE) {
+        board->tx_capture[board->tx_capture_len++] = (uint8_t) TXREG1;
+    }
+    update_tx_flags();
+}
+
+/* High priority interrupts are served first. Host code runs to completion, so
+ * a high priority request raised inside the low priority vector is served
+ * right after it returns instead of preempting it. */
+void host_service_interrupts(void) {
+    update_tx_flags();
+    for (;;) {
+        if (INTCONbits.GIEH && is_pending(1)) {
+            dispatch(highPriorityISR);
+        } else if (RCONbits.IPEN && INTCONbits.GIEH && INTCONbits.GIEL && is_pending(0)) {
+            dispatch(lowPriorityISR);
+        } else {
+            break;
+        }
+    }
+}
+
+/* **** Peripherals **** */
+
+void host_boot(void) {
+    memset((void *) &host_sfr, 0, sizeof (host_sfr));
+    board->timebase_elapsed_us = 0;
+    board->timer2_elapsed_us = 0;
+    init_vars(&board->aircraft);
+    init_ports();
+    init_serial();
+    init_interrupts();
+    init_adc();
+    init_timer();
+    start_system();
+}
+
+void host_uart_rx(uint8_t byte) {
+    host_uart_rx_error(byte, 0, 0);
+}
+
+void host_uart_rx_error(uint8_t byte, uint8_t overrun, uint8_t framing) {
+    RCSTA1bits.OERR = overrun ? 1 : 0;
+    RCSTA1bits.FERR = framing ? 1 : 0;
+    RCREG1 = byte;
+    PIR1bits.RC1IF = 1;
+    host_service_interrupts();
+}
+
+size_t host_uart_tx_take(uint8_t *out, size_t max) {
+    size_t n = board->tx_capture_len < max ? board->tx_capture_len : max;
+    memcpy(out, board->tx_capture, n);
+    memmove(board->tx_capture, board->tx_capture + n, board->tx_capture_len - n);
+    board->tx_capture_len -= n;
+    return n;
+}
+
+void host_uart_tx_clear(void) {
+    board->tx_capture_len = 0;
+}
+
+/* TIMER1 with CCP1 in special event trigger mode raises CCP1IF on every match */
+static uint8_t is_ccp1_timebase(void) {
+    return T1CONbits.TMR1ON && CCP1CONbits.CCP1M == 0b1011;
+}
+
+/* Microseconds between two interrupts of the running timebase */
+static unsigned long timebase_event_us(void) {
+    if (is_ccp1_timebase())
+        return TICK_PERIOD_MS * 1000UL / TIMEBASE_EVENTS_PER_TICK;
+    return TICK_PERIOD_MS * 1000UL;
+}
+
+/* Loads the running timebase counter with the counts of us past its last event,
+ * so that timebase_phase() and the flight recorder read the modelled time */
+static void set_timebase_counter(unsigned long us) {
+    unsigned long counts = us * TIMEBASE_EVENT_COUNTS / timebase_event_us();
+    if (is_ccp1_timebase()) {
+        TMR1H = (uint8_t) (counts >> 8);
+        TMR1L = (uint8_t) counts;
+    } else if (T0CONbits.TMR0ON) {
+        counts += TIMER0_RELOAD;
+        TMR0H = (uint8_t) (counts >> 8);
+        TMR0L = (uint8_t) counts;
+    }
+}
+
+void host_timer_phase_us(unsigned long us) {
+    set_timebase_counter(us % timebase_event_us());
+}
+
+void host_timer2_period(void) {
+    if (!T2CONbits.TMR2ON) return;
+    PIR1bits.TMR2IF = 1;
+    host_service_interrupts();
+}
+
+void host_timer_tick(void) {
+    // The compare events of a tick all fire now, each with the counter just reset
+    set_timebase_counter(0);
+    if (T0CONbits.TMR0ON) {
+        INTCONbits.TMR0IF = 1;
+        host_service_interrupts();
+    }
+    if (is_ccp1_timebase()) {
+        for (uint8_t i = 0; i < TIMEBASE_EVENTS_PER_TICK; i++) {
+            set_timebase_counter(0);
+            PIR1bits.CCP1IF = 1;
+            host_service_interrupts();
+        }
+    }
+    for (unsigned i = 0; i < TICK_PERIOD_MS * 1000UL / DEBOUNCE_SAMPLE_US; i++) {
+        host_timer2_period();
+    }
+}
+
+void host_elapse_us(unsigned long us) {
+    while (us > 0) {
+        uint8_t timebase_on = T0CONbits.TMR0ON || is_ccp1_timebase();
+        if (!timebase_on) board->timebase_elapsed_us = 0;
+        if (!T2CONbits.TMR2ON) board->timer2_elapsed_us = 0;
+
+        // Advance to the earlier of the next timebase event and the next TIMER2 period
+        unsigned long step = us;
+        if (timebase_on && timebase_event_us() - board->timebase_elapsed_us < step)
+            step = timebase_event_us() - board->timebase_elapsed_us;
+        if (T2CONbits.TMR2ON && DEBOUNCE_SAMPLE_US - board->timer2_elapsed_us < step)
+            step = DEBOUNCE_SAMPLE_US - board->timer2_elapsed_us;
+        us -= step;
+
+        if (timebase_on && (board->timebase_elapsed_us += step) == timebase_event_us()) {
+            board->timebase_elapsed_us = 0;
+            set_timebase_counter(0);
+            if (T0CONbits.TMR0ON) INTCONbits.TMR0IF = 1;
+            else PIR1bits.CCP1IF = 1;
+            host_service_interrupts();
+            host_adc_step(); // A conversion started by the event completes well before the next one
+        } else if (timebase_on) {
+            set_timebase_counter(board->timebase_elapsed_us);
+        }
+        if (T2CONbits.TMR2ON && (board->timer2_elapsed_us += step) == DEBOUNCE_SAMPLE_US) {
+            board->timer2_elapsed_us = 0;
+            host_timer2_period();
+        }
+    }
+}
+
+void host_adc_set_input(uint16_t value) {
+    board->adc_input = value & 0x3FF;
+}
+
+void host_adc_step(void) {
+    if (!ADCON0bits.GODONE) return;
+    /* Right justified result, as configured by ADCON2 */
+    ADRESH = (uint8_t) (board->adc_input >> 8);
+    ADRESL = (uint8_t) (board->adc_input & 0xFF);
+    ADCON0bits.GODONE = 0;
+    PIR1bits.ADIF = 1;
+    host_service_interrupts();
+}
+
+void host_portb_write(uint8_t rb4_7) {
+    PORTB = (uint8_t) ((PORTB & 0x0F) | ((rb4_7 & 0x0F) << 4));
+}
@@ -0,0 +1,94 @@
+/*
+ * File:   hal.h
+ * Host peripheral model for running main.c natively.
+ *
+ * The firmware's ISRs are plain functions in the host build. The helpers
+ * below raise the same interrupt flags the hardware would and then dispatch
+ * highPriorityISR() or lowPriorityISR() according to IPEN, the priority bits
+ * and GIEH/GIEL, so the firmware runs exactly the code paths it runs on the
+ * board. Main loop work is not run by the helpers: call host_service_tasks().
+ *
+ * Every helper acts on the board selected for the calling thread. Threads start
+ * on one shared default board; host_board_new() and host_select() give each
+ * thread any number of independent aircraft, each with its own SFRs and capture.
+ */
+
+#ifndef HOST_HAL_H
+#define	HOST_HAL_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+    /* Interrupt vectors of main.c */
+    void highPriorityISR(void);
+    void lowPriorityISR(void);
+
+    typedef struct host_board host_board_t;
+
+    /* Allocates a board, zeroed: select it and call host_boot() before use */
+    host_board_t *host_board_new(void);
+    void host_board_free(host_board_t *board);
+    /* Makes the board current for the calling thread, NULL selects the default one */
+    void host_select(host_board_t *board);
+
+    /* Runs the initialization sequence of main() without entering its loop */
+    void host_boot(void);
+
+    /* Runs service_tasks() of main() once for the selected board */
+    void host_service_tasks(void);
+    /* EVENT_* bits still pending after it. While any is set the device's main
+     * loop does not sleep, e.g. during a flight recorder dump. */
+    uint8_t host_events_pending(void);
+
+    /* Dispatches the ISRs until no enabled interrupt is pending */
+    void host_service_interrupts(void);
+
+    /* A byte arrives on RX1 */
+    void host_uart_rx(uint8_t byte);
+    /* A byte arrives on RX1 with the given OERR and FERR levels. Both are only
+     * modelled for this byte: the next one clears them. */
+    void host_uart_rx_error(uint8_t byte, uint8_t overrun, uint8_t framing);
+    /* Moves up to max transmitted bytes out of the capture buffer */
+    size_t host_uart_tx_take(uint8_t *out, size_t max);
+    /* Discards the transmitted bytes */
+    void host_uart_tx_clear(void);
+
+    /* One TICK_PERIOD_MS elapses on the running timebase (TIMER0 overflow or
+     * TIMEBASE_EVENTS_PER_TICK CCP1 compare matches). TIMER2 advances by the
+     * same time, if it is running. */
+    void host_timer_tick(void);
+
+    /* One TIMER2 period (DEBOUNCE_SAMPLE_US) elapses, if TIMER2 is running */
+    void host_timer2_period(void);
+
+    /* The given time elapses: the timebase and TIMER2 interrupts fall due in
+     * order, each timer counting from when it was turned on. ADC conversions
+     * started by the timebase complete right after their event. */
+    void host_elapse_us(unsigned long us);
+
+    /* The running timebase counter reads us (modulo the timebase event period)
+     * past its last event, for drivers that step whole ticks with
+     * host_timer_tick() and deliver the bytes in between at their own times */
+    void host_timer_phase_us(unsigned long us);
+
+    /* Sets the analog input level (0-1023) seen by the ADC */
+    void host_adc_set_input(uint16_t value);
+    /* Completes a conversion, if one was started with GODONE */
+    void host_adc_step(void);
+
+    /* Sets the levels of RB4-RB7 (bit 0 is RB4), debounce_isr() samples them on TIMER2 */
+    void host_portb_write(uint8_t rb4_7);
+
+    /* Number of RESET() and SLEEP() calls, per thread */
+    extern _Thread_local unsigned long host_reset_count;
+    extern _Thread_local unsigned long host_sleep_count;
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* HOST_HAL_H */
@@ -0,0 +1,12 @@
+/* 
+ * File:   p18cxxx.h
+ * Host stand-in for the legacy PIC18 header included by pragmas.h.
+ * Everything the firmware needs is already declared by the host xc.h.
+ */
+
+#ifndef HOST_P18CXXX_H
+#define	HOST_P18CXXX_H
+
+#include <xc.h>
+
+#endif	/* HOST_P18CXXX_H */
@@ -0,0 +1,212 @@
+/*
+ * File:   plane.c
+ * Firmware stand-in on a pseudo-terminal.
+ *
+ * Usage: plane [-l link] [-a adc] [-s script]
+ *
+ * Runs main.c's own ISRs and main loop iteration in real time behind a Linux
+ * pty, so the simulator can be pointed at the printed device (or at the -l
+ * symlink) instead of /dev/ttyUSB0. Time elapses through host_elapse_us() in
+ * DEBOUNCE_SAMPLE_US steps, so ticks, ADC conversions and button samples fall
+ * due as on the board. The transmitter is not paced at the baud rate.
+ *
+ * -a sets the ADC input (0-1023, default 512). The script and stdin take one
+ * command per line; script lines start with the time in seconds after GO:
+ *
+ *     12.5 adc 300        set the ADC input
+ *     13 press 4          press and release RB4 (4-7)
+ *
+ * On stdin the time is left out and the command applies right away. The
+ * script restarts after every END.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <xc.h>
+#include "hal.h"
+#include "../pragmas.h"
+#include "../main.h"
+
+#define MAX_SCRIPT_LINES 1024
+#define PRESS_US 80000UL    /* A press is held for 80 ms, then released */
+
+typedef struct {
+    unsigned long at_us; /* After GO */
+    char command[8];
+    unsigned value;
+} script_line_t;
+
+static script_line_t script[MAX_SCRIPT_LINES];
+static size_t script_length = 0;
+static size_t script_next = 0;
+
+static uint8_t buttons = 0; /* Levels of RB4-RB7, bit 0 is RB4 */
+static unsigned long release_at_us[4];
+static unsigned long flight_us = 0; /* Time since the timebase was started by GO */
+
+static unsigned long now_us(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (unsigned long) t.tv_sec * 1000000UL + (unsigned long) t.tv_nsec / 1000UL;
+}
+
+static void run_command(const char *command, unsigned value) {
+    if (strcmp(command, "adc") == 0) {
+        host_adc_set_input((uint16_t) value);
+    } else if (strcmp(command, "press") == 0 && value >= 4 && value <= 7) {
+        buttons |= (uint8_t) (1 << (value - 4));
+        release_at_us[value - 4] = flight_us + PRESS_US;
+        host_portb_write(buttons);
+    } else {
+        fprintf(stderr, "plane: unknown command '%s %u'\n", command, value);
+    }
+}
+
+static void load_script(const char *path) {
+    FILE *f = fopen(path, "r");
+    char line[128];
+    if (!f) {
+        perror(path);
+        exit(1);
+    }
+    while (fgets(line, sizeof (line), f) && script_length < MAX_SCRIPT_LINES) {
+        double at;
+        script_line_t *s = &script[script_length];
+        if (line[0] == '#' || sscanf(line, "%lf %7s %u", &at, s->command, &s->value) != 3)
+            continue;
+        s->at_us = (unsigned long) (at * 1e6);
+        script_length++;
+    }
+    fclose(f);
+}
+
+static void read_stdin(void) {
+    char line[128], command[8];
+    unsigned value;
+    ssize_t n = read(STDIN_FILENO, line, sizeof (line) - 1);
+    if (n <= 0) return;
+    line[n] = '\0';
+    if (sscanf(line, "%7s %u", command, &value) == 2)
+        run_command(command, value);
+}
+
+/* Advances the firmware by us microseconds of real time */
+static void elapse(unsigned long us) {
+    uint8_t flying = T0CONbits.TMR0ON || T1CONbits.TMR1ON;
+    if (!flying) {
+        flight_us = 0;
+        script_next = 0;
+    }
+    host_elapse_us(us);
+    if (!flying) return;
+
+    flight_us += us;
+    while (script_next < script_length && script[script_next].at_us <= flight_us) {
+        run_command(script[script_next].command, script[script_next].value);
+        script_next++;
+    }
+    for (uint8_t b = 0; b < 4; b++) {
+        if ((buttons & (1 << b)) && release_at_us[b] <= flight_us) {
+            buttons &= (uint8_t) ~(1 << b);
+            host_portb_write(buttons);
+        }
+    }
+}
+
+/* One main loop iteration, then the frames it queued go out on the pty */
+static void service(int master) {
+    uint8_t out[256];
+    size_t n;
+    host_service_tasks();
+    host_service_interrupts();
+    while ((n = host_uart_tx_take(out, sizeof (out))) > 0) {
+        if (write(master, out, n) < 0 && errno != EAGAIN) perror("plane: write");
+    }
+}
+
+static int open_pty(const char *link) {
+    struct termios tio;
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0) {
+        perror("plane: pty");
+        exit(1);
+    }
+    const char *slave_name = ptsname(master);
+    // Keep the slave open, so the master does not see EIO while no client is connected
+    int slave = open(slave_name, O_RDWR | O_NOCTTY);
+    if (slave < 0 || tcgetattr(slave, &tio) < 0) {
+        perror(slave_name);
+        exit(1);
+    }
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+    if (link) {
+        unlink(link);
+        if (symlink(slave_name, link) < 0) perror(link);
+    }
+    printf("%s\n", slave_name);
+    fflush(stdout);
+    return master;
+}
+
+int main(int argc, char **argv) {
+    const char *link = NULL;
+    unsigned adc = 512;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:a:s:")) != -1) {
+        switch (opt) {
+            case 'l': link = optarg;
+                break;
+            case 'a': adc = (unsigned) strtoul(optarg, NULL, 10);
+                break;
+            case 's': load_script(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-l link] [-a adc] [-s script]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    int master = open_pty(link);
+    host_boot();
+    host_adc_set_input((uint16_t) adc);
+
+    struct pollfd fds[2] = {
+        {.fd = master, .events = POLLIN},
+        {.fd = STDIN_FILENO, .events = POLLIN},
+    };
+    unsigned long last = now_us();
+    for (;;) {
+        unsigned long now = now_us();
+        unsigned long next = last + DEBOUNCE_SAMPLE_US;
+        int timeout_ms = next > now ? (int) ((next - now + 999) / 1000) : 0;
+        if (poll(fds, 2, timeout_ms) < 0 && errno != EINTR) {
+            perror("plane: poll");
+            return 1;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            uint8_t in[256];
+            ssize_t n = read(master, in, sizeof (in));
+            for (ssize_t i = 0; i < n; i++) host_uart_rx(in[i]);
+        }
+        if (fds[1].revents & POLLIN) read_stdin();
+        if (fds[1].revents & POLLHUP) fds[1].fd = -1;
+
+        now = now_us();
+        if (now >= next) {
+            elapse(now - last);
+            last = now;
+        }
+        service(master);
+    }
+}
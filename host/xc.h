@@ -0,0 +1,428 @@
+/*
+ * File:   xc.h
+ * Host stand-in for the XC8 device header of the PIC18F8722.
+ *
+ * Every special function register used by the firmware is mapped to a plain
+ * memory location inside host_sfr, with the same bit layout as the device so
+ * that main.c compiles unmodified with a native compiler. Peripherals are
+ * modelled in hal.c, which also provides the entry points that call the ISRs.
+ */
+
+#ifndef HOST_XC_H
+#define	HOST_XC_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+    /* **** Register layouts (bit 0 first, as in the device header) **** */
+
+    typedef union {
+        struct {
+            uint8_t RBIF : 1;
+            uint8_t INT0IF : 1;
+            uint8_t TMR0IF : 1;
+            uint8_t RBIE : 1;
+            uint8_t INT0IE : 1;
+            uint8_t TMR0IE : 1;
+            uint8_t PEIE : 1;
+            uint8_t GIE : 1;
+        };
+        struct {
+            uint8_t : 6;
+            uint8_t GIEL : 1;
+            uint8_t GIEH : 1;
+        };
+        uint8_t reg;
+    } INTCONbits_t;
+
+    typedef union {
+        struct {
+            uint8_t RBIP : 1;
+            uint8_t INT3IP : 1;
+            uint8_t TMR0IP : 1;
+            uint8_t INTEDG3 : 1;
+            uint8_t INTEDG2 : 1;
+            uint8_t INTEDG1 : 1;
+            uint8_t INTEDG0 : 1;
+            uint8_t RBPU : 1;
+        };
+        uint8_t reg;
+    } INTCON2bits_t;
+
+    typedef union {
+        struct {
+            uint8_t BOR : 1;
+            uint8_t POR : 1;
+            uint8_t PD : 1;
+            uint8_t TO : 1;
+            uint8_t RI : 1;
+            uint8_t : 1;
+            uint8_t SBOREN : 1;
+            uint8_t IPEN : 1;
+        };
+        uint8_t reg;
+    } RCONbits_t;
+
+    typedef union {
+        struct {
+            uint8_t T0PS : 3;
+            uint8_t PSA : 1;
+            uint8_t T0SE : 1;
+            uint8_t T0CS : 1;
+            uint8_t T08BIT : 1;
+            uint8_t TMR0ON : 1;
+        };
+        uint8_t reg;
+    } T0CONbits_t;
+
+    typedef union {
+        struct {
+            uint8_t SCS : 2;
+            uint8_t IOFS : 1;
+            uint8_t OSTS : 1;
+            uint8_t IRCF : 3;
+            uint8_t IDLEN : 1;
+        };
+        uint8_t reg;
+    } OSCCONbits_t;
+
+    typedef union {
+        struct {
+            uint8_t TMR1ON : 1;
+            uint8_t TMR1CS : 1;
+            uint8_t T1SYNC : 1;
+            uint8_t T1OSCEN : 1;
+            uint8_t T1CKPS : 2;
+            uint8_t T1RUN : 1;
+            uint8_t RD16 : 1;
+        };
+        uint8_t reg;
+    } T1CONbits_t;
+
+    typedef union {
+        struct {
+            uint8_t T2CKPS : 2;
+            uint8_t TMR2ON : 1;
+            uint8_t T2OUTPS : 4;
+            uint8_t : 1;
+        };
+        uint8_t reg;
+    } T2CONbits_t;
+
+    typedef union {
+        struct {
+            uint8_t CCP1M : 4;
+            uint8_t DC1B : 2;
+            uint8_t P1M : 2;
+        };
+        uint8_t reg;
+    } CCP1CONbits_t;
+
+    typedef union {
+        struct {
+            uint8_t TMR1IF : 1;
+            uint8_t TMR2IF : 1;
+            uint8_t CCP1IF : 1;
+            uint8_t SSP1IF : 1;
+            uint8_t TX1IF : 1;
+            uint8_t RC1IF : 1;
+            uint8_t ADIF : 1;
+            uint8_t PSPIF : 1;
+        };
+        struct {
+            uint8_t : 4;
+            uint8_t TXIF : 1;
+            uint8_t RCIF : 1;
+        };
+        uint8_t reg;
+    } PIR1bits_t;
+
+    typedef union {
+        struct {
+            uint8_t TMR1IE : 1;
+            uint8_t TMR2IE : 1;
+            uint8_t CCP1IE : 1;
+            uint8_t SSP1IE : 1;
+            uint8_t TX1IE : 1;
+            uint8_t RC1IE : 1;
+            uint8_t ADIE : 1;
+            uint8_t PSPIE : 1;
+        };
+        struct {
+            uint8_t : 4;
+            uint8_t TXIE : 1;
+            uint8_t RCIE : 1;
+        };
+        uint8_t reg;
+    } PIE1bits_t;
+
+    typedef union {
+        struct {
+            uint8_t TMR1IP : 1;
+            uint8_t TMR2IP : 1;
+            uint8_t CCP1IP : 1;
+            uint8_t SSP1IP : 1;
+            uint8_t TX1IP : 1;
+            uint8_t RC1IP : 1;
+            uint8_t ADIP : 1;
+            uint8_t PSPIP : 1;
+        };
+        struct {
+            uint8_t : 4;
+            uint8_t TXIP : 1;
+            uint8_t RCIP : 1;
+        };
+        uint8_t reg;
+    } IPR1bits_t;
+
+    typedef union {
+        struct {
+            uint8_t RX9D : 1;
+            uint8_t OERR : 1;
+            uint8_t FERR : 1;
+            uint8_t ADDEN : 1;
+            uint8_t CREN : 1;
+            uint8_t SREN : 1;
+            uint8_t RX9 : 1;
+            uint8_t SPEN : 1;
+        };
+        uint8_t reg;
+    } RCSTA1bits_t;
+
+    typedef union {
+        struct {
+            uint8_t TX9D : 1;
+            uint8_t TRMT : 1;
+            uint8_t BRGH : 1;
+            uint8_t SENDB : 1;
+            uint8_t SYNC : 1;
+            uint8_t TXEN : 1;
+            uint8_t TX9 : 1;
+            uint8_t CSRC : 1;
+        };
+        uint8_t reg;
+    } TXSTA1bits_t;
+
+    typedef union {
+        struct {
+            uint8_t ABDEN : 1;
+            uint8_t WUE : 1;
+            uint8_t : 1;
+            uint8_t BRG16 : 1;
+            uint8_t TXCKP : 1;
+            uint8_t RXDTP : 1;
+            uint8_t RCIDL : 1;
+            uint8_t ABDOVF : 1;
+        };
+        uint8_t reg;
+    } BAUDCON1bits_t;
+
+    typedef union {
+        struct {
+            uint8_t ADON : 1;
+            uint8_t GODONE : 1;
+            uint8_t CHS : 4;
+        };
+        struct {
+            uint8_t : 1;
+            uint8_t GO : 1;
+        };
+        struct {
+            uint8_t : 1;
+            uint8_t DONE : 1;
+        };
+        uint8_t reg;
+    } ADCON0bits_t;
+
+    typedef union {
+        struct {
+            uint8_t R0 : 1;
+            uint8_t R1 : 1;
+            uint8_t R2 : 1;
+            uint8_t R3 : 1;
+            uint8_t R4 : 1;
+            uint8_t R5 : 1;
+            uint8_t R6 : 1;
+            uint8_t R7 : 1;
+        };
+        struct {
+            uint8_t RB0 : 1;
+            uint8_t RB1 : 1;
+            uint8_t RB2 : 1;
+            uint8_t RB3 : 1;
+            uint8_t RB4 : 1;
+            uint8_t RB5 : 1;
+            uint8_t RB6 : 1;
+            uint8_t RB7 : 1;
+        };
+        struct {
+            uint8_t LA0 : 1;
+        };
+        struct {
+            uint8_t LB0 : 1;
+        };
+        struct {
+            uint8_t LC0 : 1;
+        };
+        struct {
+            uint8_t LD0 : 1;
+        };
+        uint8_t reg;
+    } PORTbits_t;
+
+    /* **** Register file **** */
+
+    /* All registers live in one block so that a device reset is a single memset.
+     * TXREG1 is wider than the device register: hal.c preloads it with an
+     * out-of-range value before every ISR dispatch to detect when the
+     * firmware has loaded a byte for transmission. */
+    typedef struct {
+        INTCONbits_t intconbits;
+        INTCON2bits_t intcon2bits;
+        RCONbits_t rconbits;
+        OSCCONbits_t osccon;
+        T0CONbits_t t0conbits;
+        uint8_t tmr0h;
+        uint8_t tmr0l;
+        T1CONbits_t t1conbits;
+        uint8_t tmr1h;
+        uint8_t tmr1l;
+        T2CONbits_t t2conbits;
+        uint8_t tmr2;
+        uint8_t pr2;
+        CCP1CONbits_t ccp1conbits;
+        uint8_t ccpr1h;
+        uint8_t ccpr1l;
+
+        PIR1bits_t pir1bits;
+        PIE1bits_t pie1bits;
+        IPR1bits_t ipr1bits;
+
+        RCSTA1bits_t rcsta1bits;
+        TXSTA1bits_t txsta1bits;
+        BAUDCON1bits_t baudcon1bits;
+        uint8_t spbrg1;
+        uint8_t rcreg1;
+        uint16_t txreg1;
+
+        ADCON0bits_t adcon0bits;
+        uint8_t adcon1;
+        uint8_t adcon2;
+        uint8_t adresh;
+        uint8_t adresl;
+
+        PORTbits_t portabits, portbbits, portcbits, portdbits, porthbits;
+        PORTbits_t latabits, latbbits, latcbits, latdbits, lathbits;
+        uint8_t trisa, trisb, trisc, trisd, trish;
+    } host_sfr_t;
+
+    /* The SFRs of the board hal.c has selected for the calling thread */
+    extern _Thread_local volatile host_sfr_t *host_sfr_current;
+#define host_sfr (*host_sfr_current)
+
+#define INTCONbits      (host_sfr.intconbits)
+#define INTCON          (host_sfr.intconbits.reg)
+#define INTCON2bits     (host_sfr.intcon2bits)
+#define INTCON2         (host_sfr.intcon2bits.reg)
+#define RCONbits        (host_sfr.rconbits)
+#define RCON            (host_sfr.rconbits.reg)
+#define T0CONbits       (host_sfr.t0conbits)
+#define T0CON           (host_sfr.t0conbits.reg)
+#define OSCCONbits      (host_sfr.osccon)
+#define OSCCON          (host_sfr.osccon.reg)
+#define TMR0H           (host_sfr.tmr0h)
+#define TMR0L           (host_sfr.tmr0l)
+#define T1CONbits       (host_sfr.t1conbits)
+#define T1CON           (host_sfr.t1conbits.reg)
+#define TMR1H           (host_sfr.tmr1h)
+#define TMR1L           (host_sfr.tmr1l)
+#define T2CONbits       (host_sfr.t2conbits)
+#define T2CON           (host_sfr.t2conbits.reg)
+#define TMR2            (host_sfr.tmr2)
+#define PR2             (host_sfr.pr2)
+#define CCP1CONbits     (host_sfr.ccp1conbits)
+#define CCP1CON         (host_sfr.ccp1conbits.reg)
+#define CCPR1H          (host_sfr.ccpr1h)
+#define CCPR1L          (host_sfr.ccpr1l)
+
+#define PIR1bits        (host_sfr.pir1bits)
+#define PIR1            (host_sfr.pir1bits.reg)
+#define PIE1bits        (host_sfr.pie1bits)
+#define PIE1            (host_sfr.pie1bits.reg)
+#define IPR1bits        (host_sfr.ipr1bits)
+#define IPR1            (host_sfr.ipr1bits.reg)
+
+#define RCSTA1bits      (host_sfr.rcsta1bits)
+#define RCSTAbits       (host_sfr.rcsta1bits)
+#define RCSTA1          (host_sfr.rcsta1bits.reg)
+#define TXSTA1bits      (host_sfr.txsta1bits)
+#define TXSTAbits       (host_sfr.txsta1bits)
+#define TXSTA1          (host_sfr.txsta1bits.reg)
+#define BAUDCON1bits    (host_sfr.baudcon1bits)
+#define BAUDCON1        (host_sfr.baudcon1bits.reg)
+#define SPBRG1          (host_sfr.spbrg1)
+#define RCREG1          (host_sfr.rcreg1)
+#define TXREG1          (host_sfr.txreg1)
+
+#define ADCON0bits      (host_sfr.adcon0bits)
+#define ADCON0          (host_sfr.adcon0bits.reg)
+#define ADCON1          (host_sfr.adcon1)
+#define ADCON2          (host_sfr.adcon2)
+#define ADRESH          (host_sfr.adresh)
+#define ADRESL          (host_sfr.adresl)
+
+#define PORTAbits       (host_sfr.portabits)
+#define PORTBbits       (host_sfr.portbbits)
+#define PORTCbits       (host_sfr.portcbits)
+#define PORTDbits       (host_sfr.portdbits)
+#define PORTHbits       (host_sfr.porthbits)
+#define PORTA           (host_sfr.portabits.reg)
+#define PORTB           (host_sfr.portbbits.reg)
+#define PORTC           (host_sfr.portcbits.reg)
+#define PORTD           (host_sfr.portdbits.reg)
+#define PORTH           (host_sfr.porthbits.reg)
+#define LATAbits        (host_sfr.latabits)
+#define LATBbits        (host_sfr.latbbits)
+#define LATCbits        (host_sfr.latcbits)
+#define LATDbits        (host_sfr.latdbits)
+#define LATHbits        (host_sfr.lathbits)
+#define LATA            (host_sfr.latabits.reg)
+#define LATB            (host_sfr.latbbits.reg)
+#define LATC            (host_sfr.latcbits.reg)
+#define LATD            (host_sfr.latdbits.reg)
+#define LATH            (host_sfr.lathbits.reg)
+#define TRISA           (host_sfr.trisa)
+#define TRISB           (host_sfr.trisb)
+#define TRISC           (host_sfr.trisc)
+#define TRISD           (host_sfr.trisd)
+#define TRISH           (host_sfr.trish)
+
+    /* **** Compiler intrinsics **** */
+
+    /* ISRs become plain functions that hal.c dispatches */
+#define __interrupt(priority)
+
+    void host_reset(void);
+    void host_sleep(void);
+
+#define __delay_us(x) ((void) (x))
+#define __delay_ms(x) ((void) (x))
+#define RESET() host_reset()
+#define NOP() ((void) 0)
+#define SLEEP() host_sleep()
+
+    /* **** Flight state **** */
+
+    /* The vectors and main() use the aircraft of the selected board (hal.c)
+     * instead of the single one the device build defines in main.h */
+    struct aircraft *host_aircraft(void);
+#define AIRCRAFT (host_aircraft())
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* HOST_XC_H */
@@ -7,12 +7,25 @@
  */
 
 /**
- * In each iteration of the loop, the parser works if the input buffer is not empty
- * and the ADC operation is started if altitude calculation is needed.
+ * The main loop is driven by events the interrupts post: the parser runs when bytes
+ * were received and the frames of the ticks posted by the timer interrupt are
+ * formatted and queued. With no event pending the CPU sleeps in IDLE mode until the
+ * next interrupt, and the time slept is reported as the CPU load by $STA#.
  * 
- * RB buttons, TIMER0 timer, ADC and serial communication are handled using interrupts.
- * Buffer operations (push and pop) disable interrupts temporarily since serial
- * interrupts also use them, which may create race conditions.
+ * Interrupts use two priority levels. Only UART RX and TX are high priority. The
+ * timebase, ADC and button interrupts are low priority and only capture state
+ * (the tick count, an ADC snapshot, button flags) for the main loop. No ISR waits:
+ * the transmit interrupt is disabled when OUTBUF runs empty and re-armed by the
+ * next frame, and the main loop turns the transmitter off after the last byte.
+ * 
+ * RB buttons, the 100ms timebase, ADC and serial communication are handled using interrupts.
+ * By default the timebase is TIMER1 reset by the CCP1 special event trigger, so the
+ * tick spacing does not depend on interrupt latency (see TIMEBASE in main.h).
+ * Each buffer is a single-producer/single-consumer ring: the producer only writes
+ * head and the consumer only writes tail, so neither side needs to disable
+ * interrupts. A push into a full ring is refused instead of overwriting unread data.
+ * Refused data, the highest occupancy of each ring and the UART receive errors are
+ * counted, and $STA# streams the counters back (see StatsCounter in main.h).
  * 
  * When $END# message is received, the system resets itself. This is due to the
  * fact that resetting all the variables in END is cumbersome, so that they can be
@@ -23,11 +36,25 @@
  * PARSE_HEADER corresponds to parsing of the letter part of the message: END, GOO,
  * ALT etc. PARSE_BODY corresponds to parsing of the number part of the message,
  * count of parsing digits being determined using the message type parsed in the header.
+ * After $BIN01# the frames are sent in a compact binary format (see BINARY_SYNC in
+ * main.h) and binary frames are accepted next to the ASCII ones; $BIN00# or END
+ * returns to ASCII only.
+ * 
+ * ADC conversions are started by the timebase, one every ADC_SAMPLE_EVENTS compare
+ * events and only while the altitude period is not 0. The samples of each tick are
+ * handed to the main loop with the tick, averaged over the altitude period and only
+ * converted to altitude value when an ALT message is sent. adc_to_alt() applies
+ * hysteresis at the band edges so that a knob resting on an edge does not flicker.
  * 
- * ADC is saved as it is and only converted to altitude value when needed. ADC is
- * also only read when altitude period is not 0, checked in adc_task().
+ * The buttons are not read from the RB change interrupt. While manual mode is on,
+ * TIMER2 samples RB4-RB7 every DEBOUNCE_SAMPLE_US and a vertical counter (one 2-bit
+ * counter per pin, kept in two bytes) accepts a new level after 4 equal samples, so
+ * bouncing is filtered out without ever delaying inside an interrupt.
  * 
- * RB interrupt also uses a small delay in order to prevent the effects of re-bouncing.
+ * A flight recorder keeps the last TRACE_SIZE events (received bytes, timebase
+ * events, handled messages, encoded frames, refused buffer writes...) with the
+ * timebase phase they happened at. $TRC# freezes it and streams it back at the
+ * pace of the UART, next to the telemetry (see TraceEvent in main.h).
  * 
  * There are a few issues in the code when run with the autopilot simulator. Sometimes
  * the distance message is not sent, maybe due to disabling of the interrupts. The
@@ -51,244 +78,368 @@
 #include "main.h"
 #include <stdint.h>
 
-// These are used to disable/enable UART interrupts before/after
-// buffering functions are called from the main thread. This prevents
-// critical race conditions that result in corrupt buffer data and hence
-// incorrect processing
-
-
 // Disables all interrupts to enforce synchronization
 
 inline void disable_interrupts(void) {
     INTCONbits.GIE = 0;
 }
 
-// Enables all interrupts
+// Enables all interrupts (GIE is GIEH when priorities are enabled)
 
 inline void enable_interrupts(void) {
     INTCONbits.GIE = 1;
 }
 
-// Enables TIMER0 module for counting 100ms
-
-inline void enable_timer0() {
+#if TIMEBASE == TIMEBASE_CCP1
+#if TIMER1_COMPARE > 0xFFFF
+#error "TIMER1 compare value does not fit into 16 bits, increase TIMEBASE_EVENTS_PER_TICK"
+#endif
+#if TIMER1_TICK_COUNTS % TIMEBASE_EVENTS_PER_TICK != 0
+#error "TIMEBASE_EVENTS_PER_TICK does not divide the tick period exactly"
+#endif
+#else
+#if TIMER0_COUNTS > 0xFFFF
+#error "TICK_PERIOD_MS is too long for TIMER0"
+#endif
+#endif
+
+#if TIMER2_COUNTS > 256 || TIMER2_COUNTS < 1
+#error "DEBOUNCE_SAMPLE_US does not fit into TIMER2, change TIMER2_PRESCALE or TIMER2_POSTSCALE"
+#endif
+
+#if (TRACE_SIZE & TRACE_MASK) != 0 || TRACE_SIZE > 128
+#error "TRACE_SIZE must be 0 or a power of two not larger than 128"
+#endif
+
+// Starts the timebase for counting TICK_PERIOD_MS, the first tick comes a full period later
+
+inline void enable_timebase(aircraft_t *ac) {
+#if TIMEBASE == TIMEBASE_CCP1
+    TMR1H = 0; // High byte is buffered, written together with the low byte
+    TMR1L = 0;
+    ac->timebase_events = 0;
+    PIR1bits.CCP1IF = 0;
+    PIE1bits.CCP1IE = 1;
+    T1CONbits.TMR1ON = 1;
+#else
     INTCONbits.TMR0IE = 1;
     T0CONbits.TMR0ON = 1;
+#endif
 }
 
-// Disables TIMER0 module
+// Stops the timebase
 
-inline void disable_timer0() {
+inline void disable_timebase() {
+#if TIMEBASE == TIMEBASE_CCP1
+    PIE1bits.CCP1IE = 0;
+    T1CONbits.TMR1ON = 0;
+#else
     INTCONbits.TMR0IE = 0;
     T0CONbits.TMR0ON = 0;
+#endif
+}
+
+// Starts sampling the buttons, taking their current levels as the debounced ones
+
+inline void enable_debounce(aircraft_t *ac) {
+    ac->portb_state = PORTB & BUTTON_MASK;
+    ac->portb_count0 = 0xFF; // Both counter bits set means no pending change
+    ac->portb_count1 = 0xFF;
+    TMR2 = 0;
+    PIR1bits.TMR2IF = 0;
+    PIE1bits.TMR2IE = 1;
+    T2CONbits.TMR2ON = 1;
+}
+
+// Stops sampling the buttons
+
+inline void disable_debounce() {
+    PIE1bits.TMR2IE = 0;
+    T2CONbits.TMR2ON = 0;
 }
 
-/* Taken from sample code written by Uluc Saranli */
+/* Based on sample code written by Uluc Saranli */
 
 /* **** Ring-buffers for incoming and outgoing data **** */
 // These buffer functions are modularized to handle both the input and
 // output buffers with an input argument.
-
-typedef enum {
-    INBUF = 0, OUTBUF = 1
-} buf_t;
-
-#define BUFSIZE 255     /* Static buffer size. Maximum amount of data */
-uint8_t inbuf[BUFSIZE]; /* Preallocated buffer for incoming data */
-uint8_t outbuf[BUFSIZE]; /* Preallocated buffer for outgoing data  */
-uint8_t head[2] = {0, 0}; /* head for pushing, tail for popping */
-uint8_t tail[2] = {0, 0};
+//
+// Each ring has exactly one producer and one consumer:
+//   INBUF:  receive_isr() pushes, parse() pops
+//   OUTBUF: the send_* functions push, transmit_isr() pops
+// The producer only writes head and the consumer only writes tail. Both are
+// single bytes, each loaded or stored by one instruction also through the
+// aircraft pointer (FSR/INDF), and neither side read-modify-writes the other's,
+// so no interrupt masking is needed. One slot is kept free to tell a full ring from an empty one.
+// The statistics are written by the producer only as well.
 
 /* Check if a buffer had data or not */
 #pragma interrupt_level 2 // Prevents duplication of function
 
-uint8_t buf_isempty(buf_t buf) {
-    return (head[buf] == tail[buf]) ? 1 : 0;
+uint8_t buf_isempty(aircraft_t *ac, buf_t buf) {
+    return (ac->rings[buf].head == ac->rings[buf].tail) ? 1 : 0;
 }
-/* Place new data in buffer */
+
+/* Check if a buffer can take another byte or not */
 #pragma interrupt_level 2 // Prevents duplication of function
 
-void buf_push(uint8_t v, buf_t buf) {
-    if (buf == INBUF) inbuf[head[buf]] = v;
-    else outbuf[head[buf]] = v;
-    head[buf]++;
-    if (head[buf] == BUFSIZE) head[buf] = 0;
+uint8_t buf_isfull(aircraft_t *ac, buf_t buf) {
+    ring_t *ring = &ac->rings[buf];
+    return (((ring->head + 1) & ring->mask) == ring->tail) ? 1 : 0;
 }
 
-/* Retrieve data from buffer */
+/* Number of bytes a buffer can take */
 #pragma interrupt_level 2 // Prevents duplication of function
 
-uint8_t buf_pop(buf_t buf) {
-    uint8_t v;
-    if (buf_isempty(buf)) {
-        return 0xFF;
-    } else {
-        if (buf == INBUF) v = inbuf[tail[buf]];
-        else v = outbuf[tail[buf]];
-        tail[buf]++;
-        if (tail[buf] == BUFSIZE) tail[buf] = 0;
-        return v;
-    }
+uint8_t buf_space(aircraft_t *ac, buf_t buf) {
+    ring_t *ring = &ac->rings[buf];
+    return (ring->tail - ring->head - 1) & ring->mask;
 }
 
-/* End of Uluc Saranli's code */
+/* Place new data in buffer. Returns 0 and drops the data if the buffer is full */
+#pragma interrupt_level 2 // Prevents duplication of function
 
-/* **** ISR functions **** */
+uint8_t buf_push(aircraft_t *ac, uint8_t v, buf_t buf) {
+    ring_t *ring = &ac->rings[buf];
+    uint8_t head = ring->head;
+    uint8_t mask = ring->mask;
+    uint8_t next = (head + 1) & mask;
+    uint8_t tail = ring->tail;
+    if (next == tail) {
+        ring->drops++;
+        TRACE(ac, TRACE_RX_DROP, buf);
+        return 0;
+    }
+    ring->data[head] = v;
+    ring->head = next; // Publish only after the data is stored
+    uint8_t used = (next - tail) & mask;
+    if (used > ring->high_water) {
+        ring->high_water = used;
+    }
+    return 1;
+}
 
-/* Interrupt callback for manual control mode, RB4-7 */
-void portb_isr() {
+/* Retrieve data from buffer. Returns 0xFF if the buffer is empty */
+#pragma interrupt_level 2 // Prevents duplication of function
 
-    /* Reading from PORTB may fluctuate if we don't wait */
-    __delay_us(1000);
+uint8_t buf_pop(aircraft_t *ac, buf_t buf) {
+    ring_t *ring = &ac->rings[buf];
+    uint8_t tail = ring->tail;
+    if (tail == ring->head) {
+        return 0xFF;
+    }
+    uint8_t v = ring->data[tail];
+    ring->tail = (tail + 1) & ring->mask; // Release the slot only after the data is read
+    return v;
+}
 
-    /* We store current and previous states since the action shall happen after
-     * when the button is pressed and released */
-    bool current[4]; // Current state of the PORTB
-    // Load the current state
-    current[0] = PORTBbits.RB4;
-    current[1] = PORTBbits.RB5;
-    current[2] = PORTBbits.RB6;
-    current[3] = PORTBbits.RB7;
+/* Place a block of data in buffer. Either all of it is placed and 1 is returned,
+ * or nothing is placed and 0 is returned */
+#pragma interrupt_level 2 // Prevents duplication of function
 
-    /* If the LED of RBX (i.e. RX0) is on (i.e. portb_enable) and the button was pressed
-     * in the previous interrupt and now it is released, we flag that we need to send PRS0X
-     */
-    if (portb_enable[0] && !current[0] && portb_prev[0]) { // PRS04
-        portb_send[0] = true;
+uint8_t buf_write(aircraft_t *ac, const uint8_t *data, uint8_t length, buf_t buf) {
+    ring_t *ring = &ac->rings[buf];
+    uint8_t head = ring->head;
+    uint8_t tail = ring->tail;
+    uint8_t mask = ring->mask;
+    uint8_t space = (tail - head - 1) & mask;
+    if (length > space) {
+        ring->drops++;
+        TRACE(ac, TRACE_TX_DROP, length);
+        return 0;
     }
-    if (portb_enable[1] && !current[1] && portb_prev[1]) { // PRS05
-        portb_send[1] = true;
+    for (uint8_t i = 0; i < length; i++) {
+        ring->data[head] = data[i];
+        head = (head + 1) & mask;
     }
-    if (portb_enable[2] && !current[2] && portb_prev[2]) { // PRS06
-        portb_send[2] = true;
-    }
-    if (portb_enable[3] && !current[3] && portb_prev[3]) { // PRS07
-        portb_send[3] = true;
-
+    ring->head = head; // Publish the whole block at once
+    uint8_t used = (head - tail) & mask;
+    if (used > ring->high_water) {
+        ring->high_water = used;
     }
+    return 1;
+}
 
-    /* Save the current state as the previous for further interrupts */
-    portb_prev[0] = current[0];
-    portb_prev[1] = current[1];
-    portb_prev[2] = current[2];
-    portb_prev[3] = current[3];
+/* **** ISR functions **** */
 
-    INTCONbits.RBIF = 0; // Acknowledge interrupt
+/* Interrupt callback for manual control mode, samples RB4-7 */
+void debounce_isr(aircraft_t *ac) {
+    PIR1bits.TMR2IF = 0; // Acknowledge interrupt
+
+    /* Every pin has a 2-bit counter: bit n of portb_count0/portb_count1. It is held
+     * at 3 while the pin reads its debounced level and counts down on every sample
+     * that differs, so the level is taken after 4 differing samples in a row. */
+    uint8_t delta = (PORTB & BUTTON_MASK) ^ ac->portb_state;
+    ac->portb_count0 = ~(ac->portb_count0 & delta);
+    ac->portb_count1 = ac->portb_count0 ^ (ac->portb_count1 & delta);
+    delta &= ac->portb_count0 & ac->portb_count1; // Pins whose counter rolled over
+    ac->portb_state ^= delta;
+
+    /* The action shall happen when the button is pressed and released, so we flag
+     * PRS0X for the enabled (i.e. its LED is on) buttons whose level has just fallen.
+     * Only this ISR sets bits of portb_send, and nothing that writes the byte can
+     * preempt it; the main loop clears them through clear_press() with GIEL masked. */
+    ac->portb_send |= delta & (uint8_t) ~ac->portb_state & ac->portb_enable;
 }
 
-void receive_isr() {
-    /* Clear any error */
-    RCSTAbits.OERR = 0;
-    RCSTAbits.FERR = 0;
-
-    /* Re-enable receive interrupt in case of an error */
-    RCSTAbits.CREN = 1;
+void receive_isr(aircraft_t *ac) {
+    /* FERR belongs to the byte at the top of the FIFO, so it is read before RCREG1 */
+    if (RCSTAbits.FERR) {
+        ac->uart_framing_errors++;
+    }
 
-    /* Save the received data to the buffer */
-    buf_push(RCREG1, INBUF); // Buffer incoming byte
+    /* Save the received data to the buffer, the byte is lost if INBUF is full */
+    uint8_t byte = RCREG1;
+    TRACE(ac, TRACE_RX, byte);
+    buf_push(ac, byte, INBUF); // Buffer incoming byte
+    ac->events |= EVENT_RX; // Nothing preempts the high priority vector
+
+    /* After an overrun the receiver stops until it is reset by clearing CREN,
+     * which also clears OERR */
+    if (RCSTAbits.OERR) {
+        ac->uart_overruns++;
+        RCSTAbits.CREN = 0;
+        RCSTAbits.CREN = 1;
+    }
 
     PIR1bits.RC1IF = 0; // Acknowledge interrupt
 }
 
-void transmit_isr() {
-    PIR1bits.TX1IF = 0; // Acknowledge interrupt
-
-    if (buf_isempty(OUTBUF)) { // If all bytes are transmitted
-        while (!TXSTA1bits.TRMT); // If we remove this line, the last sent character cannot be transmitted, it waits for a couple of ns
-        TXSTA1bits.TXEN = 0; // Turn off the transmission
+// TX1IF is read-only, it clears when TXREG1 is loaded and stays set while the
+// transmitter waits, so the interrupt is acknowledged by loading or disabling.
+void transmit_isr(aircraft_t *ac) {
+    if (buf_isempty(ac, OUTBUF)) { // If all bytes are handed to the transmitter
+        // The last byte may still be shifting out, so the transmitter stays on and
+        // finish_transmission() turns it off later. send() re-arms the interrupt.
+        PIE1bits.TX1IE = 0;
+        TRACE(ac, TRACE_TX_DONE, 0);
     } else { // Otherwise
-        TXREG1 = buf_pop(OUTBUF); // Load next byte to the register
+        TXREG1 = buf_pop(ac, OUTBUF); // Load next byte to the register
     }
 }
 
-void timer_isr() {
+void timer_isr(aircraft_t *ac) {
+#if TIMEBASE == TIMEBASE_CCP1
+    PIR1bits.CCP1IF = 0; // Acknowledge interrupt, TIMER1 has already been reset by the hardware
+#else
     INTCONbits.TMR0IF = 0; // Acknowledge interrupt
     TMR0H = TMR0H_INIT; // initialize TIMER0 value
     TMR0L = TMR0L_INIT; // initialize TIMER0 value
+#endif
 
-    // Decrement speed from distance in every timer interrupt regardless of which message is sent
-    if (dist >= speed)
-        dist -= speed;
-    else // Do not get below of 0 distance
-        dist = 0;
-
-    // Increase the number of sent messages by one to track message count for altitude messages
-    counter++;
-    /* If altitude_period is 0, since counter is always increased, it will not get into send_altitude if block
-     * Otherwise, when the period comes, the send_altitude if block will be executed
-     * If the PORTB interrupt callback has flagged that any button was pressed, their message
-     * will be sent instead of distance message.
-     * If there isn't any waiting message (altitude or button), distance message is sent as usual
-     */
-    if (altitude_period != PERIOD_0 && counter == altitude_period) {
-        send_altitude(adc);
-        counter = 0;
-    } else if (portb_send[0]) {
-        send_button_press(4);
-        portb_send[0] = false;
-    } else if (portb_send[1]) {
-        send_button_press(5);
-        portb_send[1] = false;
-    } else if (portb_send[2]) {
-        send_button_press(6);
-        portb_send[2] = false;
-    } else if (portb_send[3]) {
-        send_button_press(7);
-        portb_send[3] = false;
-    } else {
-        send_distance(dist);
+    // Start a conversion every ADC_SAMPLE_EVENTS events while altitude is reported
+    if (ac->altitude_period != PERIOD_0 && ++ac->adc_sample_events >= ADC_SAMPLE_EVENTS) {
+        ac->adc_sample_events = 0;
+        ADCON0bits.GODONE = 1;
+        TRACE(ac, TRACE_ADC_START, ac->altitude_period);
     }
 
-    /* If altitude_period is 0, the send_altitude if block will never be executed;
-     * hence, we need to reset the counter explicitly if altitude_period is 0
-     */
-    if (altitude_period == 0)
-        counter = 0;
+#if TIMEBASE == TIMEBASE_CCP1
+    // Only every TIMEBASE_EVENTS_PER_TICK-th compare event is a tick
+    if (++ac->timebase_events < TIMEBASE_EVENTS_PER_TICK) {
+        TRACE(ac, TRACE_TIMEBASE, ac->timebase_events);
+        return;
+    }
+    ac->timebase_events = 0;
+#endif
+
+    // The frame is formatted by telemetry_task() in the main loop. Here we only
+    // post the tick together with the ADC samples taken during it.
+    ac->adc_snapshot_sum = ac->adc_tick_sum;
+    ac->adc_snapshot_count = ac->adc_tick_count;
+    ac->adc_tick_sum = 0;
+    ac->adc_tick_count = 0;
+    ac->ticks_posted++;
+    INTCONbits.GIEH = 0; // receive_isr() must not set EVENT_RX in the middle of this
+    ac->events |= EVENT_TICK;
+    INTCONbits.GIEH = 1;
+    TRACE(ac, TRACE_TICK, ac->ticks_posted);
 }
 
-void adc_isr() {
-    // Save ADC value to the variable
-    adc = (ADRESH << 8) | (ADRESH & 0xF);
+void adc_isr(aircraft_t *ac) {
+    // Accumulate the right justified 10-bit result for the current tick
+    ac->adc_tick_sum += ((uint16_t) ADRESH << 8) | ADRESL;
+    ac->adc_tick_count++;
 
     PIR1bits.ADIF = 0; // Acknowledge interrupt
 }
 
 void __interrupt(high_priority) highPriorityISR(void) {
-    /* Dispatch the interrupt callbacks */
-    if (PIR1bits.RC1IF) receive_isr();
-    if (PIR1bits.TX1IF) transmit_isr();
-    if (INTCONbits.TMR0IF) timer_isr();
-    if (INTCONbits.RBIF) portb_isr();
-    if (PIR1bits.ADIF) adc_isr();
+    /* Only the serial port is high priority, so received bytes are never
+     * delayed behind the other interrupts */
+    if (PIR1bits.RC1IF) receive_isr(AIRCRAFT);
+    if (PIE1bits.TX1IE && PIR1bits.TX1IF) {
+        // TX1IF stays set while the transmitter is idle, TX1IE is what gates it
+        transmit_isr(AIRCRAFT);
+    }
 }
 
 void __interrupt(low_priority) lowPriorityISR(void) {
-    // No use for low priority interrupts
+    /* Dispatch the interrupt callbacks that only capture state for the main loop */
+    if (TIMEBASE_IF) timer_isr(AIRCRAFT);
+    if (PIR1bits.TMR2IF) debounce_isr(AIRCRAFT);
+    if (PIR1bits.ADIF) adc_isr(AIRCRAFT);
 }
 
 /* **** Initialization functions **** */
 
-/* Initialize the global variables to 0 in case of reset */
-void init_vars() {
-    dist = 0;
-    altitude_period = PERIOD_0;
-    is_manual = false;
-    adc = 0;
-    counter = 0;
-    speed = 0;
-    parse_state = PARSE_IDLE;
-    message_pos = 0;
-    parsed_number = 0;
-    digit_count_to_be_parsed = 0;
-    parsed_digit_count = 0;
-    portb_prev[0] = portb_prev[1] = portb_prev[2] = portb_prev[3] = false;
-    portb_enable[0] = portb_enable[1] = portb_enable[2] = portb_enable[3] = false;
-    portb_send[0] = portb_send[1] = portb_send[2] = portb_send[3] = false;
-
-    head[INBUF] = 0;
-    head[OUTBUF] = 0;
-    tail[INBUF] = 0;
-    tail[OUTBUF] = 0;
+/* Initialize the flight state to 0 in case of reset */
+void init_vars(aircraft_t *ac) {
+    ac->dist = 0;
+    ac->altitude_period = PERIOD_0;
+    ac->is_manual = 0;
+    ac->binary_mode = 0;
+    ac->adc = 0;
+    ac->counter = 0;
+    ac->speed = 0;
+    ac->ticks_posted = 0;
+    ac->ticks_done = 0;
+    ac->events = 0;
+    ac->idle_counts = 0;
+    ac->load_ticks = 0;
+    ac->cpu_load = 0;
+    ac->adc_sample_events = 0;
+    ac->adc_tick_sum = 0;
+    ac->adc_tick_count = 0;
+    ac->adc_snapshot_sum = 0;
+    ac->adc_snapshot_count = 0;
+    ac->adc_period_sum = 0;
+    ac->adc_period_count = 0;
+    ac->alt_band = ALT_BAND_NONE;
+    ac->parse_state = PARSE_IDLE;
+    ac->message_key = 0;
+    ac->message_pos = 0;
+    ac->parsed_number = 0;
+    ac->digit_count_to_be_parsed = 0;
+    ac->parsed_digit_count = 0;
+    ac->message_crc = 0;
+    ac->portb_state = 0;
+    ac->portb_count0 = 0xFF;
+    ac->portb_count1 = 0xFF;
+    ac->portb_enable = 0;
+    ac->portb_send = 0;
+
+    ac->rings[INBUF].data = ac->inbuf_data;
+    ac->rings[OUTBUF].data = ac->outbuf_data;
+    ac->rings[INBUF].mask = INBUF_MASK;
+    ac->rings[OUTBUF].mask = OUTBUF_MASK;
+    ac->rings[INBUF].head = 0;
+    ac->rings[OUTBUF].head = 0;
+    ac->rings[INBUF].tail = 0;
+    ac->rings[OUTBUF].tail = 0;
+    ac->rings[INBUF].high_water = 0;
+    ac->rings[OUTBUF].high_water = 0;
+    ac->rings[INBUF].drops = 0;
+    ac->rings[OUTBUF].drops = 0;
+    ac->uart_overruns = 0;
+    ac->uart_framing_errors = 0;
+
+#if TRACE_SIZE
+    ac->trace_head = 0;
+    ac->trace_count = 0;
+    ac->trace_dump = 0;
+    ac->trace_frozen = false;
+#endif
 }
 
 /* Initialize the ports */
@@ -323,25 +474,37 @@ void init_serial() {
     SPBRG1 = 21;
 
     RCSTA1bits.SPEN = 1; // RC6-7 are used for serial communication
-    PIE1bits.TXIE = 1; // Enable interrupt for transmission
+    PIE1bits.TXIE = 0; // Armed by send() once there is data to transmit
     PIE1bits.RCIE = 1; // Enable interrupt for reception
     RCSTAbits.CREN = 1; // Enable reception
 }
 
 /* Initialize the interrupt flags */
 void init_interrupts() {
-    // Enable peripheral interrupts
-    INTCONbits.PEIE = 1;
+    // Use two interrupt priority levels
+    RCONbits.IPEN = 1;
+
+    // Serial port is high priority
+    IPR1bits.RC1IP = 1;
+    IPR1bits.TX1IP = 1;
+
+    // The timebase, the ADC and the button sampling are low priority
+    IPR1bits.CCP1IP = 0;
+    INTCON2bits.TMR0IP = 0;
+    IPR1bits.ADIP = 0;
+    IPR1bits.TMR2IP = 0;
 
-    // Enable reception and transmission interrupts
+    // Enable low priority interrupts
+    INTCONbits.GIEL = 1;
+
+    // Enable reception interrupt, the transmission interrupt is enabled by send()
     PIE1bits.RC1IE = 1;
-    PIE1bits.TX1IE = 1;
 
     // Enable ADC interrupt
     PIE1bits.ADIE = 1;
 
-    // Enable RB button press interrupt
-    INTCONbits.RBIE = 1;
+    // The buttons are sampled by TIMER2, the RB change interrupt is not used
+    INTCONbits.RBIE = 0;
 
     // Enable all interrupts
     enable_interrupts();
@@ -356,64 +519,84 @@ void init_adc() {
     ADRESL = 0x00; // Zero the conversion result at the start
 }
 
-/* Initialize the TIMER0 */
+/* Initialize the timebase */
 void init_timer() {
+#if TIMEBASE == TIMEBASE_CCP1
+    // TIMER1 counts and CCP1 resets it on every compare match, so no reload is
+    // done in software and the ISR latency never adds up
+    T1CON = 0b10110000; // 16-bit read/write, 1:8 pre-scaler, internal clock, turned off at start
+    TMR1H = 0;
+    TMR1L = 0;
+    CCPR1H = (uint8_t) (TIMER1_COMPARE >> 8);
+    CCPR1L = (uint8_t) (TIMER1_COMPARE & 0xFF);
+    CCP1CON = 0b00001011; // Compare mode, special event trigger
+#else
     // Initialize timer that counts 100 ms
     T0CON = 0b00000011; // 16-bit, 1:16 pre-scaler, turned off at start
 
     /* Initialize the TIMER0 value that will count to 100ms */
     TMR0H = TMR0H_INIT;
     TMR0L = TMR0L_INIT;
+#endif
+
+    // TIMER2 samples the buttons every DEBOUNCE_SAMPLE_US, turned off at start
+    T2CON = ((TIMER2_POSTSCALE - 1) << 3) | 0b10; // Post-scaler, 1:16 pre-scaler
+    PR2 = TIMER2_COUNTS - 1; // TIMER2 counts 0..PR2
 }
 
 /* Start system */
 void start_system() {
+    // SLEEP enters IDLE mode, so the timers and the UART keep running
+    OSCCONbits.IDLEN = 1;
+
     // Enable the interrupts
     INTCONbits.GIE = 1;
 }
 
 /* Function to be called when GOO message is received */
-void get_go(uint16_t distance) {
-    dist = distance; // Set the distance to the value got in the received message
-    enable_timer0(); // Enable 100ms timer
+void get_go(aircraft_t *ac, uint16_t distance) {
+    ac->dist = distance; // Set the distance to the value got in the received message
+    enable_timebase(ac); // Enable 100ms timer
 }
 
 /* Function to be called when END message is received */
-void get_end() {
-    dist = 0; // Zero the distance
-    disable_timer0(); // Disable the 100ms timer (we will not send any message anymore)
+void get_end(aircraft_t *ac) {
+    ac->dist = 0; // Zero the distance
+    disable_timebase(); // Disable the 100ms timer (we will not send any message anymore)
     RESET(); // Reset the system to clean all the state
 }
 
 /* Function to be called when SPD message is received */
-void get_speed(uint16_t spd) {
-    speed = spd; // Set the speed to the value got in the received message
+void get_speed(aircraft_t *ac, uint16_t spd) {
+    ac->speed = spd; // Set the speed to the value got in the received message
 }
 
 /* Function to be called when ALT message is received */
-void get_altitude(uint16_t period) {
+void get_altitude(aircraft_t *ac, uint16_t period) {
     /* AltitudePeriod's values are 0, 2, 4 and 6. These values
      * correspond to 0, 200, 400 and 600ms periods respectively.
      * So we can just divide by 100
      */
-    altitude_period = (AltitudePeriod) (period / 100);
+    ac->altitude_period = (AltitudePeriod) (period / 100);
 
-    /* Zero the counter */
-    counter = 0;
+    /* Zero the counter and start averaging a new period */
+    ac->counter = 0;
+    ac->adc_period_sum = 0;
+    ac->adc_period_count = 0;
 }
 
 /* Function to be called when MAN message is received */
-void get_manual(uint8_t activation) {
-    is_manual = activation; // Set the manual state
-    if (is_manual) {
-        INTCONbits.RBIE = 1; // Enable button interrupt if manual state is enabled
+void get_manual(aircraft_t *ac, uint8_t activation) {
+    ac->is_manual = activation != 0; // Set the manual state
+    if (ac->is_manual) {
+        enable_debounce(ac); // Sample the buttons if manual state is enabled
     } else {
-        INTCONbits.RBIE = 0; // Disable button interrupt if manual state is disabled.
+        disable_debounce(); // Stop sampling if manual state is disabled
     }
 }
 
 /* Function to be called when LED message is received */
-void get_led(uint8_t led) {
+void get_led(aircraft_t *ac, uint8_t led) {
     switch (led) {
         case 0: // LED00
             // Turn off all LEDs
@@ -422,42 +605,102 @@ void get_led(uint8_t led) {
             LATCbits.LC0 = 0;
             LATDbits.LD0 = 0;
             // Disable all buttons
-            portb_enable[0] = false;
-            portb_enable[1] = false;
-            portb_enable[2] = false;
-            portb_enable[3] = false;
+            ac->portb_enable = 0;
             break;
         case 1: // LED01
             // Turn on corresponding LED and enable the corresponding port
             LATDbits.LD0 = 1;
-            portb_enable[0] = true;
+            ac->portb_enable |= BUTTON_RB4;
             break;
         case 2: // LED02
             // Turn on corresponding LED and enable the corresponding port
             LATCbits.LC0 = 1;
-            portb_enable[1] = true;
+            ac->portb_enable |= BUTTON_RB5;
             break;
         case 3: // LED03
             // Turn on corresponding LED and enable the corresponding port
             LATBbits.LB0 = 1;
-            portb_enable[2] = true;
+            ac->portb_enable |= BUTTON_RB6;
             break;
         case 4: // LED04
             // Turn on corresponding LED and enable the corresponding port
             LATAbits.LA0 = 1;
-            portb_enable[3] = true;
+            ac->portb_enable |= BUTTON_RB7;
             break;
     }
 }
 
+/* Function to be called when BIN message is received */
+void get_binary(aircraft_t *ac, uint8_t enable) {
+    ac->binary_mode = enable != 0; // Following frames are encoded in the negotiated format
+}
+
+/* Reads a 16-bit counter that an ISR may change between reading its two bytes */
+uint16_t read_counter(volatile uint16_t *counter) {
+    uint16_t value;
+    do {
+        value = *counter;
+    } while (value != *counter);
+    return value;
+}
+
+/* Returns the StatsCounter with the given index */
+uint16_t read_stat(aircraft_t *ac, uint8_t counter) {
+    switch (counter) {
+        case STAT_RX_DROPS:
+            return read_counter(&ac->rings[INBUF].drops); // Counted by receive_isr()
+        case STAT_TX_DROPS:
+            return ac->rings[OUTBUF].drops;
+        case STAT_RX_HIGH_WATER:
+            return ac->rings[INBUF].high_water;
+        case STAT_TX_HIGH_WATER:
+            return ac->rings[OUTBUF].high_water;
+        case STAT_UART_OVERRUNS:
+            return read_counter(&ac->uart_overruns);
+        case STAT_UART_FRAMING_ERRORS:
+            return read_counter(&ac->uart_framing_errors);
+        case STAT_CPU_LOAD:
+            return ac->cpu_load;
+    }
+    return 0;
+}
+
+/* Function to be called when STA message is received, queues one frame per counter */
+void get_stats(aircraft_t *ac) {
+    for (uint8_t i = 0; i < STAT_COUNT; i++) {
+        send_frame(ac, OUT_STATS, ((uint32_t) i << 16) | read_stat(ac, i));
+    }
+}
+
+/* Packs a flight recorder entry into the value of a TRC frame */
+static uint32_t trace_value(uint8_t event, uint8_t payload, uint16_t time) {
+    return ((uint32_t) event << 24) | ((uint32_t) payload << 16) | time;
+}
+
+/* Function to be called when TRC message is received. Freezes the flight recorder
+ * and queues the header of the dump, trace_task() streams the entries */
+void get_trace(aircraft_t *ac) {
+    if (ac->events & EVENT_TRACE) {
+        return; // A dump is already running
+    }
+    send_frame(ac, OUT_TRACE, trace_value(TRACE_DUMP, TIMEBASE_TICK_COUNTS / TIMEBASE_EVENT_COUNTS,
+            TIMEBASE_EVENT_COUNTS));
+#if TRACE_SIZE
+    ac->trace_frozen = true;
+    ac->trace_dump = ac->trace_head - ac->trace_count; // The oldest entry
+#endif
+    set_events(ac, EVENT_TRACE);
+}
+
+/* Hexadecimal digits indexed by nibble value */
+const char hex_digits[16] = {
+    '0', '1', '2', '3', '4', '5', '6', '7',
+    '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'
+};
+
 /* Utility function to convert a nibble to hexadecimal character */
 char to_hex(uint8_t nibble) {
-    if (nibble < 10) { // Digit
-        return nibble + '0';
-    } else { // Character A-F
-        return nibble + 'A' - 10;
-    }
-    return 0xFF;
+    return hex_digits[nibble & 0xF];
 }
 
 /* Utility function to convert a hexadecimal character to a nibble */
@@ -472,297 +715,488 @@ uint8_t to_nibble(char character) {
     return 0xFF; // Invalid
 }
 
-/* Start sending the contents of the OUTBUF */
+/* Start sending the contents of the OUTBUF, called after every commit to it.
+ * Both bits are set with BSF, and a transmit_isr() that found OUTBUF empty just
+ * before the commit has cleared TX1IE before we set it again. */
 void send() {
-    TXSTA1bits.TXEN = 1; // Enable transmission interrupt, entering the interrupt immediately
+    TXSTA1bits.TXEN = 1; // Turn on the transmitter, nothing changes if it is running
+    PIE1bits.TX1IE = 1; // Re-arm the interrupt, entered as soon as TXREG1 is empty
 }
 
-// The function that writes DIST messages into the buffer
+/* Turns the transmitter off once transmit_isr() has emptied OUTBUF and the last
+ * byte has left the shift register. Polled by the main loop, so the ISR never
+ * waits for the character time of the last byte. */
+void finish_transmission() {
+    if (TXSTA1bits.TXEN && !PIE1bits.TX1IE && TXSTA1bits.TRMT) {
+        TXSTA1bits.TXEN = 0;
+    }
+}
 
-void send_distance(uint16_t distance) {
-    // Store the four nibbles of the 16-bit distance
-    uint8_t nibble0 = distance & 0xF;
-    distance >>= 4;
-    uint8_t nibble1 = distance & 0xF;
-    distance >>= 4;
-    uint8_t nibble2 = distance & 0xF;
-    distance >>= 4;
-    uint8_t nibble3 = distance & 0xF;
-
-    // While we are pushing some data to the buffer, the buffer should not
-    // receive any other data, that's why we disable the interrupts.
-    disable_interrupts();
+/* Layouts of the outgoing frames: $ + 3-character ID + digits + # */
+const FrameLayout frame_layouts[OUT_COUNT] = FRAME_LAYOUTS;
+
+// The generic encoder: builds the whole frame on the stack and commits it
+// to OUTBUF in one copy. If OUTBUF cannot hold the whole frame, the frame is
+// dropped instead of being sent truncated.
+
+void send_frame(aircraft_t *ac, OutMessageType type, uint32_t value) {
+    const FrameLayout *layout = &frame_layouts[type];
+    uint8_t length = layout->digit_count + FRAME_OVERHEAD;
+    char frame[FRAME_MAX_LENGTH];
+
+    TRACE(ac, TRACE_SEND + type, (uint8_t) value);
+
+    if (ac->binary_mode) {
+        // Sync, type, the payload in little-endian and the CRC of type and payload
+        uint8_t *bytes = (uint8_t *) frame;
+        uint8_t crc;
+        length = layout->digit_count / 2 + BINARY_OVERHEAD;
+        bytes[0] = BINARY_SYNC;
+        bytes[1] = BINARY_TYPE_OUT + type;
+        crc = crc8_update(0, bytes[1]);
+        for (uint8_t i = 2; i < length - 1; i++) {
+            bytes[i] = (uint8_t) value;
+            crc = crc8_update(crc, bytes[i]);
+            value >>= 8;
+        }
+        bytes[length - 1] = crc;
+        if (buf_write(ac, bytes, length, OUTBUF)) {
+            send();
+        }
+        return;
+    }
 
-    // Push the message to the buffer
-    buf_push('$', OUTBUF);
-    buf_push('D', OUTBUF);
-    buf_push('S', OUTBUF);
-    buf_push('T', OUTBUF);
-
-    // Convert nibbles to corresponding hexadecimal values before pushing into the buffer
-    char hex;
-    hex = to_hex(nibble3);
-    buf_push(hex, OUTBUF);
-    hex = to_hex(nibble2);
-    buf_push(hex, OUTBUF);
-    hex = to_hex(nibble1);
-    buf_push(hex, OUTBUF);
-    hex = to_hex(nibble0);
-    buf_push(hex, OUTBUF);
-
-    buf_push('#', OUTBUF);
-
-    // Enable interrupts in order for data reception to be able to continue
-    enable_interrupts();
+    frame[0] = '$';
+    frame[1] = layout->id[0];
+    frame[2] = layout->id[1];
+    frame[3] = layout->id[2];
+
+    // Fill the digits from the least significant nibble backwards
+    for (uint8_t i = length - 2; i >= 4; i--) {
+        frame[i] = hex_digits[value & 0xF];
+        value >>= 4;
+    }
+    frame[length - 1] = '#';
+
+    if (buf_write(ac, (const uint8_t *) frame, length, OUTBUF)) {
+        // Start sending the message
+        send();
+    }
+}
 
-    // Start sending the message
-    send();
+// The function that writes DIST messages into the buffer
+
+void send_distance(aircraft_t *ac, uint16_t distance) {
+    send_frame(ac, OUT_DISTANCE, distance);
 }
 
 // Utility function that converts the ADC value (that ranges between 0 and 1023)
-// to altitude value (that is either 9000, or 10000, or 11000, or 12000)
-
-uint16_t adc_to_alt(uint16_t value) {
-    if (value < 256) {
-        return 9000;
-    } else if (value < 512) {
-        return 10000;
-    } else if (value < 768) {
-        return 11000;
-    } else {
-        return 12000;
+// to altitude value (that is either 9000, or 10000, or 11000, or 12000).
+// The bands are split at 256, 512 and 768. Once a band is reported, the value
+// has to move ADC_HYSTERESIS past the edge before a neighbouring band is reported.
+
+uint16_t adc_to_alt(aircraft_t *ac, uint16_t value) {
+    uint8_t band = (uint8_t) (value >> 8); // 0-3
+
+    if (ac->alt_band != ALT_BAND_NONE) {
+        if (band > ac->alt_band && value < ((uint16_t) (ac->alt_band + 1) << 8) + ADC_HYSTERESIS) {
+            band = ac->alt_band; // Not far enough above the upper edge
+        } else if (band < ac->alt_band && value + ADC_HYSTERESIS >= ((uint16_t) ac->alt_band << 8)) {
+            band = ac->alt_band; // Not far enough below the lower edge
+        }
     }
+    ac->alt_band = band;
+
+    return 9000 + (uint16_t) band * 1000;
 }
 
 // The function that writes ALT messages into the buffer
 
-void send_altitude(uint16_t adc_value) {
+void send_altitude(aircraft_t *ac, uint16_t adc_value) {
     // Convert adc value to altitude value
-    uint16_t alt = adc_to_alt(adc_value);
-
-    // Store the four nibbles of the 16-bit altitude
-    uint8_t nibble0 = alt & 0xF;
-    alt >>= 4;
-    uint8_t nibble1 = alt & 0xF;
-    alt >>= 4;
-    uint8_t nibble2 = alt & 0xF;
-    alt >>= 4;
-    uint8_t nibble3 = alt & 0xF;
-
-    // While we are pushing some data to the buffer, the buffer should not
-    // receive any other data, that's why we disable the interrupts.
-    disable_interrupts();
-
-    // Push the message to the buffer
-    buf_push('$', OUTBUF);
-    buf_push('A', OUTBUF);
-    buf_push('L', OUTBUF);
-    buf_push('T', OUTBUF);
-
-    // Convert nibbles to corresponding hexadecimal values before pushing into the buffer
-    char hex;
-    hex = to_hex(nibble3);
-    buf_push(hex, OUTBUF);
-    hex = to_hex(nibble2);
-    buf_push(hex, OUTBUF);
-    hex = to_hex(nibble1);
-    buf_push(hex, OUTBUF);
-    hex = to_hex(nibble0);
-    buf_push(hex, OUTBUF);
-
-    buf_push('#', OUTBUF);
-
-    // Enable interrupts in order for data reception to be able to continue
-    enable_interrupts();
-
-    // Start sending the message
-    send();
+    send_frame(ac, OUT_ALTITUDE, adc_to_alt(ac, adc_value));
 }
 
 // The function that writes PRS messages into the buffer
 
-void send_button_press(uint8_t button) {
-    // Store the two nibbles of the 8-bit button value
-    uint8_t nibble0 = button & 0xF;
-    button >>= 4;
-    uint8_t nibble1 = button & 0xF;
+void send_button_press(aircraft_t *ac, uint8_t button) {
+    send_frame(ac, OUT_PRESS, button);
+}
 
-    // While we are pushing some data to the buffer, the buffer should not
-    // receive any other data, that's why we disable the interrupts.
-    disable_interrupts();
+/* Incoming messages, indexed by MessageType. Their IDs and digit counts, the
+ * header lookup below and the dispatch in handle_message() are all generated
+ * from protocol/messages.json into protocol.h. */
+const FrameLayout message_layouts[MT_COUNT] = MESSAGE_LAYOUTS;
 
-    // Push the message to the buffer
-    buf_push('$', OUTBUF);
-    buf_push('P', OUTBUF);
-    buf_push('R', OUTBUF);
-    buf_push('S', OUTBUF);
+/* Packed header key to MessageType. The table is read-only and shared by every
+ * aircraft_t, so it lives in program memory; a lookup is usually a single probe. */
+const uint32_t header_keys[HEADER_TABLE_SIZE] = HEADER_TABLE_KEYS;
+const uint8_t header_types[HEADER_TABLE_SIZE] = HEADER_TABLE_TYPES; /* MT_COUNT marks an empty slot */
 
-    // Convert nibbles to corresponding hexadecimal values before pushing into the buffer
-    char hex;
-    hex = to_hex(nibble1);
-    buf_push(hex, OUTBUF);
-    hex = to_hex(nibble0);
-    buf_push(hex, OUTBUF);
+// Returns the MessageType of a packed 3-character header, or MT_COUNT if unknown
 
-    buf_push('#', OUTBUF);
+uint8_t lookup_header(uint32_t key) {
+    uint8_t slot = HEADER_HASH((uint8_t) (key >> 16), (uint8_t) (key >> 8), (uint8_t) key);
+    while (header_types[slot] != MT_COUNT) {
+        if (header_keys[slot] == key) {
+            return header_types[slot];
+        }
+        slot = (slot + 1) & HEADER_TABLE_MASK;
+    }
+    return MT_COUNT;
+}
 
-    // Enable interrupts in order for data reception to be able to continue
-    enable_interrupts();
+/* CRC-8 with polynomial 0x07, processed a nibble at a time */
+const uint8_t crc8_nibbles[16] = {
+    0x00, 0x07, 0x0E, 0x09, 0x1C, 0x1B, 0x12, 0x15,
+    0x38, 0x3F, 0x36, 0x31, 0x24, 0x23, 0x2A, 0x2D
+};
+
+uint8_t crc8_update(uint8_t crc, uint8_t byte) {
+    crc ^= byte;
+    crc = (uint8_t) (crc << 4) ^ crc8_nibbles[crc >> 4];
+    crc = (uint8_t) (crc << 4) ^ crc8_nibbles[crc >> 4];
+    return crc;
+}
 
-    // Start sending the message
-    send();
+// Calls the handler of the parsed message. Returns 0 if the system was reset.
+// The cases come from MESSAGE_HANDLERS, the argument kind selects how the parsed
+// number is passed.
+
+#define HANDLE_NONE(handler) handler(ac)
+#define HANDLE_U8(handler) handler(ac, (uint8_t) (ac->parsed_number & 0xFF)) // Convert uint16_t to uint8_t and then pass it
+#define HANDLE_U16(handler) handler(ac, ac->parsed_number)
+#define HANDLE_RESET(handler) handler(ac); return 0
+#define HANDLER_CASE(type, handler, argument) case type: HANDLE_##argument(handler); break;
+
+uint8_t handle_message(aircraft_t *ac) {
+    TRACE(ac, TRACE_MESSAGE + ac->message_type, (uint8_t) ac->parsed_number);
+    switch (ac->message_type) {
+        MESSAGE_HANDLERS(HANDLER_CASE)
+        default:
+            break;
+    }
+    return 1;
 }
 
 // The function that parses received messages
 
-void parse() {
-    // While we are popping some data from the buffer, the buffer should not
-    // receive any other data, that's why we disable the interrupts.
-    disable_interrupts();
+void parse(aircraft_t *ac) {
+    // receive_isr() only moves the head of INBUF and we only move its tail,
+    // so new data may keep arriving while we parse. The head is read once per
+    // batch and the tail is written back once per batch.
+    ring_t *ring = &ac->rings[INBUF];
+    uint8_t tail = ring->tail;
+    uint8_t head = ring->head;
+
+    while (tail != head) { // While INBUF is not empty
+        while (tail != head) { // For every character in the current batch
+            char value = ring->data[tail]; // Pop the next character from INBUF
+            tail = (tail + 1) & INBUF_MASK;
+
+            // The state machine that controls parsing operation
+            switch (ac->parse_state) {
+
+                    // Currently no message is being received
+                case PARSE_IDLE:
+                    if (value == '$') { // If '$' character received, switch to PARSE_HEADER state
+                        ac->parse_state = PARSE_HEADER;
+                        ac->message_key = 0;
+                        ac->message_pos = 0;
+                    } else if (ac->binary_mode && (uint8_t) value == BINARY_SYNC) { // Start of a binary frame
+                        ac->parse_state = PARSE_BINARY_TYPE;
+                    }
+                    break;
 
-    while (!buf_isempty(INBUF)) { // While INBUF is not empty
-        char value = buf_pop(INBUF); // Pop the next character from INBUF
+                    // In this state, we only receive the first 3 characters of the message.
+                    // If correctly received, go to PARSE_BODY state; else, go back to PARSE_IDLE state.
+                case PARSE_HEADER:
+                    ac->message_key = (ac->message_key << 8) | (uint8_t) value; // Pack the next character of the message into message_key
+                    ac->message_pos += 1; // Increment message position to read the next character
+
+                    if (ac->message_pos == 3) { // If 3 characters were read
+                        uint8_t type = lookup_header(ac->message_key);
+                        if (type == MT_COUNT) { // If the message header is erroneous, go back to PARSE_IDLE state
+                            ac->parse_state = PARSE_IDLE;
+                            break;
+                        }
+                        ac->message_type = (MessageType) type;
+                        ac->digit_count_to_be_parsed = message_layouts[type].digit_count;
 
-        // Since we will not pop from the buffer for a while, we should enable interrupts,
-        // because new data may arrive during that time.
-        enable_interrupts();
+                        // If the message header was correctly read, go to PARSE_BODY state
+                        ac->parse_state = PARSE_BODY;
 
-        // The state machine that controls parsing operation
-        switch (parse_state) {
+                        // Reset the variables in order to be re-used
+                        ac->parsed_digit_count = 0;
+                        ac->parsed_number = 0;
+                    }
+                    break;
 
-                // Currently no message is being received
-            case PARSE_IDLE:
-                if (value == '$') { // If '$' character received, switch to PARSE_HEADER state
-                    parse_state = PARSE_HEADER;
-                }
-                break;
-
-                // In this state, we only receive the first 3 characters of the message.
-                // If correctly received, go to PARSE_BODY state; else, go back to PARSE_IDLE state.
-            case PARSE_HEADER:
-                message_name[message_pos] = value; // Read the next character of the message into message_name
-                message_pos += 1; // Increment message position to read the next character
-
-                if (message_pos == 3) { // If 3 characters were read
-                    if (message_name[0] == 'G' && message_name[1] == 'O' && message_name[2] == 'O') { // If GOO characters were read
-                        message_type = MT_GO; // Set the message type as MT_GO
-                        digit_count_to_be_parsed = 4; // After the GOO message, 4 digits are going to be read, so this is set as 4
-                    } else if (message_name[0] == 'E' && message_name[1] == 'N' && message_name[2] == 'D') { // If END characters were read
-                        message_type = MT_END; // Set the message type as MT_END
-                        digit_count_to_be_parsed = 0; // After the END message, no digits are going to be read, so this is set as 0
-                    } else if (message_name[0] == 'S' && message_name[1] == 'P' && message_name[2] == 'D') { // If SPD characters were read
-                        message_type = MT_SPEED; // Set the message type as MT_SPEED
-                        digit_count_to_be_parsed = 4; // After the SPD message, 4 digits are going to be read, so this is set as 4
-                    } else if (message_name[0] == 'A' && message_name[1] == 'L' && message_name[2] == 'T') { // If ALT characters were read
-                        message_type = MT_ALTITUDE; // Set the message type as MT_ALTITUDE
-                        digit_count_to_be_parsed = 4; // After the ALT message, 4 digits are going to be read, so this is set as 4
-                    } else if (message_name[0] == 'M' && message_name[1] == 'A' && message_name[2] == 'N') { // If MAN characters were read
-                        message_type = MT_MANUAL; // Set the message type as MT_MANUAL
-                        digit_count_to_be_parsed = 2; // After the MAN message, 2 digits are going to be read, so this is set as 2
-                    } else if (message_name[0] == 'L' && message_name[1] == 'E' && message_name[2] == 'D') { // If LED characters were read
-                        message_type = MT_LED; // Set the message type as MT_LED
-                        digit_count_to_be_parsed = 2; // After the LED message, 2 digits are going to be read, so this is set as 2
-                    } else { // If the message header is erroneous, go back to PARSE_IDLE state
-                        parse_state = PARSE_IDLE;
+                    // In this state, we receive the numeric part of the message.
+                    // If correctly received, the corresponding message handler is called and the state is switched to PARSE_IDLE,
+                    // otherwise, the state is also switched to PARSE_IDLE.
+                case PARSE_BODY:
+                {
+                    uint8_t nibble = to_nibble(value); // 0xFF if the received character is not a hexadecimal digit
+
+                    // If the received character is digit, parse until the parsed_digit_count equals to digit_count_to_be_parsed
+                    if (nibble != 0xFF) {
+                        // If an enough number of digits were received, and a digit is received again,
+                        // the message is erroneous, so go back to PARSE_IDLE state
+                        if (ac->parsed_digit_count == ac->digit_count_to_be_parsed) {
+                            ac->parse_state = PARSE_IDLE;
+                            break;
+                        }
+
+                        // Store the received digit as nibble in the parsed_number variable
+                        ac->parsed_number <<= 4;
+                        ac->parsed_number |= nibble;
+
+                        // Increment the parsed digit count
+                        ac->parsed_digit_count += 1;
                         break;
                     }
 
-                    // If the message header was correctly read, go to PARSE_BODY state
-                    parse_state = PARSE_BODY;
+                    // If the received character is not digit and not end, message is erroneous, so go back to PARSE_IDLE state
+                    ac->parse_state = PARSE_IDLE;
+                    if (value != '#' || ac->parsed_digit_count != ac->digit_count_to_be_parsed) {
+                        break;
+                    }
 
-                    // Reset the variables in order to be re-used
-                    message_pos = 0;
-                    parsed_digit_count = 0;
-                }
-                break;
-
-                // In this state, we receive the numeric part of the message, which is 4 characters.
-                // If correctly received, the corresponding message handler is called and the state is switched to PARSE_IDLE,
-                // otherwise, the state is also switched to PARSE_IDLE.
-            case PARSE_BODY:
-            {
-                bool is_digit = (('0' <= value && value <= '9') || ('A' <= value && value <= 'F') || ('a' <= value && value <= 'f')); // If the received character is a hexadecimal digit, true
-                bool is_end = value == '#'; // If the received character is '#', true
-
-                // If the received character is not digit and not end, message is erroneous, so go back to PARSE_IDLE state
-                if (!(is_digit || is_end)) {
-                    parse_state = PARSE_IDLE;
+                    // If the end character is received after receiving the correct number of digits,
+                    // call the corresponding message handler. RESET() does not return on the
+                    // device. On the host it re-initializes INBUF, so the stale batch must not be released.
+                    if (!handle_message(ac)) {
+                        return;
+                    }
                     break;
                 }
 
-                // If the received character is digit, parse until the parsed_digit_count equals to digit_count_to_be_parsed
-                if (is_digit) {
-                    // If an enough number of digits were received, and a digit is received again,
-                    // the message is erroneous, so go back to PARSE_IDLE state
-                    if (parsed_digit_count == digit_count_to_be_parsed) {
-                        parse_state = PARSE_IDLE;
+                    // The type byte of a binary frame selects the payload length
+                case PARSE_BINARY_TYPE:
+                {
+                    uint8_t type = (uint8_t) value - BINARY_TYPE_IN;
+                    if (type >= MT_COUNT) { // Unknown type, wait for the next frame
+                        ac->parse_state = PARSE_IDLE;
                         break;
                     }
+                    ac->message_type = (MessageType) type;
+                    ac->digit_count_to_be_parsed = message_layouts[type].digit_count / 2; // Payload bytes
+                    ac->parsed_digit_count = 0;
+                    ac->parsed_number = 0;
+                    ac->message_crc = crc8_update(0, (uint8_t) value);
+                    ac->parse_state = ac->digit_count_to_be_parsed ? PARSE_BINARY_BODY : PARSE_BINARY_CRC;
+                    break;
+                }
 
-                    // Store the received digit as nibble in the parsed_number variable
-                    parsed_number <<= 4;
-                    parsed_number |= to_nibble(value);
+                    // The payload of a binary frame, least significant byte first
+                case PARSE_BINARY_BODY:
+                    ac->parsed_number |= (uint16_t) (uint8_t) value << (8 * ac->parsed_digit_count);
+                    ac->message_crc = crc8_update(ac->message_crc, (uint8_t) value);
+                    ac->parsed_digit_count += 1;
+                    if (ac->parsed_digit_count == ac->digit_count_to_be_parsed) {
+                        ac->parse_state = PARSE_BINARY_CRC;
+                    }
+                    break;
 
-                    // Increment the parsed digit count
-                    parsed_digit_count += 1;
-                }// The end character '#' is received
-                else {
-                    // If the end character is received after receiving the correct number of digits,
-                    // call the corresponding message handler
-                    if (parsed_digit_count == digit_count_to_be_parsed) {
-                        switch (message_type) {
-                            case MT_GO:
-                                get_go(parsed_number);
-                                break;
-                            case MT_END:
-                                get_end();
-                                break;
-                            case MT_SPEED:
-                                get_speed(parsed_number);
-                                break;
-                            case MT_ALTITUDE:
-                                get_altitude(parsed_number);
-                                break;
-                            case MT_MANUAL:
-                                get_manual((uint8_t) (parsed_number & 0xFF)); // Convert uint16_t to uint8_t and then pass it
-                                break;
-                            case MT_LED:
-                                get_led((uint8_t) (parsed_number & 0xFF)); // Convert uint16_t to uint8_t and then pass it
-                                break;
-                        }
+                    // A binary frame is only handled if its CRC matches
+                case PARSE_BINARY_CRC:
+                    ac->parse_state = PARSE_IDLE;
+                    if ((uint8_t) value == ac->message_crc && !handle_message(ac)) {
+                        return;
                     }
+                    break;
+            }
+        }
 
-                    // Reset the variables in order to be able to receive a new message
-                    parsed_digit_count = 0;
-                    parse_state = PARSE_IDLE;
-                    parsed_number = 0;
-                }
-                break;
+        // Release the parsed batch to receive_isr() and look for newly arrived data
+        ring->tail = tail;
+        head = ring->head;
+    }
+}
+
+// Clears a press flagged by debounce_isr() once its PRS frame is queued. The ISR
+// sets the other bits of portb_send from the low priority vector, so the
+// read-modify-write runs with the low priority interrupts masked.
+
+void clear_press(aircraft_t *ac, uint8_t button_bit) {
+    INTCONbits.GIEL = 0;
+    ac->portb_send &= (uint8_t) ~button_bit;
+    INTCONbits.GIEL = 1;
+}
+
+// The function that formats the frame of every tick posted by timer_isr()
+
+void telemetry_task(aircraft_t *ac) {
+    // The snapshot is two bytes of sum and a count, so it is taken together with
+    // the tick it belongs to while timer_isr() cannot publish the next one
+    INTCONbits.GIEL = 0;
+    uint8_t posted = ac->ticks_posted;
+    uint16_t snapshot_sum = ac->adc_snapshot_sum;
+    uint8_t snapshot_count = ac->adc_snapshot_count;
+    INTCONbits.GIEL = 1;
+
+    // Only the last of several backlogged ticks has its samples left, add them once
+    if (ac->ticks_done != posted) {
+        ac->adc_period_sum += snapshot_sum;
+        ac->adc_period_count += snapshot_count;
+    }
+
+    // ticks_posted is only written by timer_isr() and ticks_done only by us. A tick
+    // posted while we are working sets EVENT_TICK again and is taken on the next call.
+    while (ac->ticks_done != posted) {
+        ac->ticks_done++;
+
+        // Decrement speed from distance in every tick regardless of which message is sent
+        if (ac->dist >= ac->speed)
+            ac->dist -= ac->speed;
+        else // Do not get below of 0 distance
+            ac->dist = 0;
+
+        // Increase the number of sent messages by one to track message count for altitude messages
+        ac->counter++;
+        TRACE(ac, TRACE_TELEMETRY, (uint8_t) (ac->counter << 4) | ac->altitude_period);
+        /* If altitude_period is 0, since counter is always increased, it will not get into send_altitude if block
+         * Otherwise, when the period comes, the send_altitude if block will be executed
+         * If the PORTB interrupt callback has flagged that any button was pressed, their message
+         * will be sent instead of distance message.
+         * If there isn't any waiting message (altitude or button), distance message is sent as usual
+         */
+        if (ac->altitude_period != PERIOD_0 && ac->counter == ac->altitude_period) {
+            // Decimate the period to one averaged value, keeping the last one if no sample arrived
+            if (ac->adc_period_count != 0) {
+                ac->adc = (uint16_t) (ac->adc_period_sum / ac->adc_period_count);
             }
+            ac->adc_period_sum = 0;
+            ac->adc_period_count = 0;
+            send_altitude(ac, ac->adc);
+            ac->counter = 0;
+        } else if (ac->portb_send & BUTTON_RB4) {
+            send_button_press(ac, 4);
+            clear_press(ac, BUTTON_RB4);
+        } else if (ac->portb_send & BUTTON_RB5) {
+            send_button_press(ac, 5);
+            clear_press(ac, BUTTON_RB5);
+        } else if (ac->portb_send & BUTTON_RB6) {
+            send_button_press(ac, 6);
+            clear_press(ac, BUTTON_RB6);
+        } else if (ac->portb_send & BUTTON_RB7) {
+            send_button_press(ac, 7);
+            clear_press(ac, BUTTON_RB7);
+        } else {
+            send_distance(ac, ac->dist);
         }
 
-        // If the while loop continues, we will be popping some data from the buffer, and the buffer should not
-        // receive any other data, that's why we disable the interrupts.
-        disable_interrupts();
+        /* If altitude_period is 0, the send_altitude if block will never be executed;
+         * hence, we need to reset the counter explicitly if altitude_period is 0
+         */
+        if (ac->altitude_period == 0)
+            ac->counter = 0;
+
+        // Close the CPU load window every CPU_LOAD_TICKS ticks
+        if (++ac->load_ticks == CPU_LOAD_TICKS) {
+            const uint32_t window = (uint32_t) CPU_LOAD_TICKS * TIMEBASE_TICK_COUNTS;
+            ac->cpu_load = ac->idle_counts < window ? (uint16_t) (1000 - ac->idle_counts * 1000 / window) : 0;
+            ac->idle_counts = 0;
+            ac->load_ticks = 0;
+        }
     }
+}
+
+// Set or clear event bits from the main loop. The ISRs set bits of the same byte,
+// so the read-modify-write runs with interrupts disabled.
+
+void set_events(aircraft_t *ac, uint8_t bits) {
+    disable_interrupts();
+    ac->events |= bits;
+    enable_interrupts();
+}
 
-    // At the end of parsing, enable the interrupts again
+void clear_events(aircraft_t *ac, uint8_t bits) {
+    disable_interrupts();
+    ac->events &= (uint8_t) ~bits;
     enable_interrupts();
 }
 
-// The function that reads the ADC value from the ADRES register
+// One iteration of the main loop, does the work of the pending events. Each bit
+// is cleared before its work starts, so an event posted meanwhile is not lost.
 
-void adc_task() {
-    if (altitude_period != PERIOD_0) { // If the altitude period is zero, we will not send the ALT message, so we don't need to use the ADC value.
-        ADCON0bits.GODONE = 1;
+void service_tasks(aircraft_t *ac) {
+    finish_transmission();
+    if (ac->events & EVENT_RX) {
+        clear_events(ac, EVENT_RX);
+        parse(ac);
+    }
+    if (ac->events & EVENT_TICK) {
+        clear_events(ac, EVENT_TICK);
+        telemetry_task(ac);
     }
+    if (ac->events & EVENT_TRACE) {
+        trace_task(ac); // Clears the bit itself once the dump is complete
+    }
+}
+
+// Timer counts since the last timebase event. Called from every level, but only
+// with interrupts disabled (TRACE(), idle()), so its shared frame is never reentered.
+#pragma interrupt_level 2 // Prevents duplication of function
+
+uint16_t timebase_phase() {
+#if TIMEBASE == TIMEBASE_CCP1
+    uint8_t low = TMR1L; // Reading the low byte latches the high byte (RD16)
+    return ((uint16_t) TMR1H << 8) | low;
+#else
+    uint8_t low = TMR0L; // Reading the low byte latches the high byte
+    return (((uint16_t) TMR0H << 8) | low) - (uint16_t) TIMER0_RELOAD;
+#endif
+}
+
+// Streams the frozen flight recorder at the pace of the UART, keeping less than
+// TRACE_TX_BACKLOG bytes in OUTBUF. EVENT_TRACE stays set until the trailer is
+// queued, so the main loop polls instead of sleeping while the dump runs.
+
+void trace_task(aircraft_t *ac) {
+    while (OUTBUF_MASK - buf_space(ac, OUTBUF) < TRACE_TX_BACKLOG) {
+#if TRACE_SIZE
+        if (ac->trace_dump != ac->trace_head) {
+            trace_entry_t *entry = &ac->trace[ac->trace_dump & TRACE_MASK];
+            ac->trace_dump++;
+            send_frame(ac, OUT_TRACE, trace_value(entry->event, entry->payload, entry->time));
+            continue;
+        }
+        send_frame(ac, OUT_TRACE, trace_value(TRACE_DUMP_END, ac->trace_count, 0));
+        ac->trace_frozen = false;
+#else
+        send_frame(ac, OUT_TRACE, trace_value(TRACE_DUMP_END, 0, 0));
+#endif
+        clear_events(ac, EVENT_TRACE);
+        return;
+    }
+}
+
+// Sleeps until the next interrupt if no event is pending and adds the time slept
+// to the CPU load window. Interrupts are disabled from the check on, otherwise an
+// event posted right after it would be slept through; an enabled interrupt still
+// wakes the CPU with GIE clear and is served once they are enabled again.
+
+void idle(aircraft_t *ac) {
+    disable_interrupts();
+    if (ac->events == 0) {
+        uint16_t start = timebase_phase();
+        SLEEP();
+        uint16_t end = timebase_phase();
+        // Every timebase event wakes the CPU, so the timer was reset at most once
+        ac->idle_counts += (end >= start) ? end - start : end + TIMEBASE_EVENT_COUNTS - start;
+    }
+    enable_interrupts();
 }
 
 // Main routine
 
 void main(void) {
+    aircraft_t *ac = AIRCRAFT;
+
     // Initialization function calls
-    init_vars();
+    init_vars(ac);
     init_ports();
     init_serial();
     init_interrupts();
@@ -772,10 +1206,10 @@ void main(void) {
     // Start the system by enabling global interrupts
     start_system();
 
-    // Parse and ADC tasks
+    // Parse and telemetry tasks, sleeping whenever there is nothing to do
     while (1) {
-        parse();
-        adc_task();
+        service_tasks(ac);
+        idle(ac);
     }
     return;
 }
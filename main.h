@@ -14,32 +14,175 @@ extern "C" {
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "protocol.h" /* Message types and frame layouts, generated from protocol/messages.json */
     
-#define TMR0H_INIT 11
-#define TMR0L_INIT 222
+    /* **** Telemetry timebase, chosen at build time **** */
+
+#define TIMEBASE_TIMER0 0   /* TIMER0 overflow, reloaded inside the ISR. Every tick loses the ISR latency */
+#define TIMEBASE_CCP1   1   /* Free running TIMER1 reset by the CCP1 special event trigger, drift free */
+
+#ifndef TIMEBASE
+#define TIMEBASE TIMEBASE_CCP1
+#endif
+
+#define TICK_PERIOD_MS 100  /* Spacing of the DST/ALT/PRS frames */
+
+    /* TIMER0: 16-bit, 1:16 prescaler. 100 ms is 62500 counts, reloaded as 65536 - 62500.
+     * The extra 2 counts are carried over from the previously hard-coded reload value. */
+#define TIMER0_PRESCALE 16
+#define TIMER0_COUNTS (_XTAL_FREQ / 4 / TIMER0_PRESCALE * TICK_PERIOD_MS / 1000)
+#define TIMER0_RELOAD (65536 - TIMER0_COUNTS + 2)
+#define TMR0H_INIT ((uint8_t) (TIMER0_RELOAD >> 8))
+#define TMR0L_INIT ((uint8_t) (TIMER0_RELOAD & 0xFF))
+
+    /* TIMER1: 16-bit, 1:8 prescaler. A tick does not fit into 16 bits, so the compare
+     * event fires TIMEBASE_EVENTS_PER_TICK times per tick. TIMER1 counts 0..CCPR1, so
+     * the compare value is one less than the event period. */
+#define TIMER1_PRESCALE 8
+#define TIMEBASE_EVENTS_PER_TICK 2
+#define TIMER1_TICK_COUNTS (_XTAL_FREQ / 4 / TIMER1_PRESCALE * TICK_PERIOD_MS / 1000)
+#define TIMER1_COMPARE (TIMER1_TICK_COUNTS / TIMEBASE_EVENTS_PER_TICK - 1)
+
+    /* **** ADC sampling **** */
+
+    /* A conversion is started every ADC_SAMPLE_EVENTS timebase events (compare events
+     * with TIMEBASE_CCP1, ticks with TIMEBASE_TIMER0) while the altitude period is not 0 */
+#define ADC_SAMPLE_EVENTS 1
+    /* Counts the value must move past a band edge before the reported altitude changes */
+#define ADC_HYSTERESIS 8
+#define ALT_BAND_NONE 0xFF
+
+    /* **** Button debouncing **** */
+
+    /* RB4-RB7 are sampled every DEBOUNCE_SAMPLE_US by TIMER2 while manual mode is
+     * on. A pin changes its debounced level after 4 consecutive samples at the new
+     * level, i.e. the debounce time is 4 * DEBOUNCE_SAMPLE_US. */
+#define DEBOUNCE_SAMPLE_US 2000
+#define TIMER2_PRESCALE 16
+#define TIMER2_POSTSCALE 10
+#define TIMER2_COUNTS (_XTAL_FREQ / 4 / TIMER2_PRESCALE / TIMER2_POSTSCALE * DEBOUNCE_SAMPLE_US / 1000000)
+#define BUTTON_MASK 0xF0    /* RB4-RB7 */
+    /* The button flags of the aircraft keep each button in its PORTB bit */
+#define BUTTON_RB4 0x10     /* PRS04, enabled by LED01 */
+#define BUTTON_RB5 0x20     /* PRS05, enabled by LED02 */
+#define BUTTON_RB6 0x40     /* PRS06, enabled by LED03 */
+#define BUTTON_RB7 0x80     /* PRS07, enabled by LED04 */
+
+#if TIMEBASE == TIMEBASE_CCP1
+#define TIMEBASE_IF PIR1bits.CCP1IF
+#define TIMEBASE_EVENT_COUNTS (TIMER1_COMPARE + 1UL) /* Timer counts between two timebase events */
+#define TIMEBASE_TICK_COUNTS TIMER1_TICK_COUNTS
+#else
+#define TIMEBASE_IF INTCONbits.TMR0IF
+#define TIMEBASE_EVENT_COUNTS (65536UL - TIMER0_RELOAD)
+#define TIMEBASE_TICK_COUNTS TIMEBASE_EVENT_COUNTS
+#endif
+
+    /* **** Memory configuration **** */
+
+    /* Every statically reserved buffer is sized here, the one place to trade RAM
+     * between them; `make memory-report` checks the linked result against
+     * tools/memory-budget.json. Each can be overridden on the command line, e.g.
+     * -DOUTBUF_SIZE=256.
+     *
+     * INBUF_SIZE   received bytes waiting for parse(). The simulator writes one
+     *              batch of commands per period, about 40 bytes at most.
+     * OUTBUF_SIZE  frames waiting for the UART. $STA# queues one frame per
+     *              StatsCounter at once, about 100 bytes.
+     * TRACE_SIZE   flight recorder entries of 4 bytes, 0 compiles it out.
+     *
+     * All are powers of two, the rings up to 256 and the recorder up to 128. */
+#ifndef INBUF_SIZE
+#define INBUF_SIZE 64
+#endif
+#ifndef OUTBUF_SIZE
+#define OUTBUF_SIZE 128
+#endif
+#ifndef TRACE_SIZE
+#define TRACE_SIZE 128
+#endif
+
+    /* **** Main loop **** */
+
+    /* Work the ISRs post for the main loop in events. receive_isr() sets EVENT_RX
+     * from the high priority vector, timer_isr() sets EVENT_TICK from the low
+     * priority one and the main loop clears a bit before doing its work. Through
+     * the aircraft pointer XC8 does not promise a single BSF/BCF, so a writer that
+     * can be preempted by another one masks it: timer_isr() clears GIEH around its
+     * set and the main loop goes through set_events() and clear_events(), which
+     * disable all interrupts. receive_isr() cannot be preempted. */
+#define EVENT_RX 0x01       /* receive_isr() buffered bytes for parse() */
+#define EVENT_TICK 0x02     /* timer_isr() posted a tick for telemetry_task() */
+#define EVENT_TRACE 0x04    /* get_trace() started a dump, trace_task() clears it when done */
+
+    /* The CPU sleeps in IDLE mode while no event is pending. The time it spends
+     * there is measured on the timebase timer and reported as the CPU load, in
+     * permille of CPU_LOAD_TICKS ticks. */
+#define CPU_LOAD_TICKS 10
+
+    /* **** Flight recorder **** */
+
+    /* The last TRACE_SIZE events (see TraceEvent) are kept in a ring, each stamped
+     * with the timebase phase, i.e. the timer counts since the last timebase event.
+     * $TRC# freezes the ring and streams it back. A power of two up to 128; 0
+     * compiles the recorder out and $TRC# then answers with an empty dump. */
+#define TRACE_MASK (TRACE_SIZE - 1)
+    /* A dump only queues an entry while OUTBUF holds fewer bytes than this, so a
+     * telemetry frame never waits behind more than about two entries */
+#define TRACE_TX_BACKLOG (2 * FRAME_MAX_LENGTH)
+
+    /* Flight state of one aircraft, see struct aircraft below */
+    typedef struct aircraft aircraft_t;
 
     char to_hex(uint8_t nibble);
     uint8_t to_nibble(char nibble);
     uint8_t from_hex8(char high, char low);
     uint16_t from_hex16(char nibble3, char nibble2, char nibble1, char nibble0);
-    uint16_t adc_to_alt(uint16_t value);
+    uint16_t adc_to_alt(aircraft_t *ac, uint16_t value);
 
-    void init_vars();
+    void init_vars(aircraft_t *ac);
+    void init_ports();
+    void init_serial();
+    void init_interrupts();
+    void init_adc();
+    void init_timer();
+    void start_system();
 
-    void parse();
+    void debounce_isr(aircraft_t *ac);
+    void receive_isr(aircraft_t *ac);
+    void transmit_isr(aircraft_t *ac);
+    void timer_isr(aircraft_t *ac);
+    void adc_isr(aircraft_t *ac);
 
-    void get_go(uint16_t distance);
-    void get_end();
-    void get_speed(uint16_t speed);
-    void get_altitude(uint16_t period);
-    void get_manual(uint8_t activation);
-    void get_led(uint8_t led);
+    uint8_t lookup_header(uint32_t key);
+    uint8_t crc8_update(uint8_t crc, uint8_t byte);
+    uint8_t handle_message(aircraft_t *ac);
+    void parse(aircraft_t *ac);
+    void clear_press(aircraft_t *ac, uint8_t button_bit);
+    void telemetry_task(aircraft_t *ac);
+    void set_events(aircraft_t *ac, uint8_t bits);
+    void clear_events(aircraft_t *ac, uint8_t bits);
+    void service_tasks(aircraft_t *ac);
+    uint16_t timebase_phase();
+    void idle(aircraft_t *ac);
+    void trace_task(aircraft_t *ac);
 
-    void send_distance(uint16_t distance);
-    void send_altitude(uint16_t altitude);
-    void send_button_press(uint8_t button);
+    void get_go(aircraft_t *ac, uint16_t distance);
+    void get_end(aircraft_t *ac);
+    void get_speed(aircraft_t *ac, uint16_t speed);
+    void get_altitude(aircraft_t *ac, uint16_t period);
+    void get_manual(aircraft_t *ac, uint8_t activation);
+    void get_led(aircraft_t *ac, uint8_t led);
+    void get_binary(aircraft_t *ac, uint8_t enable);
+    void get_stats(aircraft_t *ac);
+    void get_trace(aircraft_t *ac);
+
+    void send_distance(aircraft_t *ac, uint16_t distance);
+    void send_altitude(aircraft_t *ac, uint16_t altitude);
+    void send_button_press(aircraft_t *ac, uint8_t button);
     
     void send();
+    void finish_transmission();
 
     typedef enum {
         PERIOD_0 = 0,
@@ -52,35 +195,185 @@ extern "C" {
         PARSE_IDLE,
         PARSE_HEADER,
         PARSE_BODY,
+        PARSE_BINARY_TYPE,
+        PARSE_BINARY_BODY,
+        PARSE_BINARY_CRC,
     } ParseState;
 
+    /* Counters reported by $STA#, one $STA<index, 2 digits><value, 4 digits># each */
     typedef enum {
-        MT_GO,
-        MT_END,
-        MT_SPEED,
-        MT_ALTITUDE,
-        MT_MANUAL,
-        MT_LED,
-    } MessageType;
-
-    uint16_t dist;
-    AltitudePeriod altitude_period;
-    uint8_t counter;
-    bool is_manual;
-    uint16_t adc;
-    uint16_t speed;
-    
-    ParseState parse_state;
-    MessageType message_type;
-    char message_name[3];
-    uint8_t message_pos;
-    uint16_t parsed_number;
-    uint8_t digit_count_to_be_parsed;
-    uint8_t parsed_digit_count;
-    
-    bool portb_prev[4];
-    bool portb_enable[4];
-    bool portb_send[4];
+        STAT_RX_DROPS, /* Bytes lost because INBUF was full */
+        STAT_TX_DROPS, /* Frames not sent because OUTBUF could not hold them */
+        STAT_RX_HIGH_WATER, /* Highest INBUF occupancy in bytes */
+        STAT_TX_HIGH_WATER, /* Highest OUTBUF occupancy in bytes */
+        STAT_UART_OVERRUNS, /* OERR: bytes lost in the receiver before receive_isr() ran */
+        STAT_UART_FRAMING_ERRORS, /* FERR: bytes received without a valid stop bit */
+        STAT_CPU_LOAD, /* Permille of the last CPU_LOAD_TICKS ticks spent awake */
+        STAT_COUNT,
+    } StatsCounter;
+
+    /* Events of the flight recorder. A dump is streamed as $TRC<event, 2 digits>
+     * <payload, 2 digits><time, 4 digits># frames: a TRACE_DUMP header, the entries
+     * oldest first and a TRACE_DUMP_END trailer. */
+    typedef enum {
+        TRACE_DUMP, /* Header, payload timebase events per tick, time TIMEBASE_EVENT_COUNTS */
+        TRACE_DUMP_END, /* Trailer, payload the number of entries dumped */
+        TRACE_RX, /* receive_isr(), payload the received byte */
+        TRACE_TX_DONE, /* transmit_isr() emptied OUTBUF and turned the transmitter off */
+        TRACE_ADC_START, /* timer_isr() started a conversion, payload altitude_period */
+        TRACE_TIMEBASE, /* timer_isr() on a compare event that is not a tick, payload timebase_events */
+        TRACE_TICK, /* timer_isr() posted a tick, payload ticks_posted */
+        TRACE_TELEMETRY, /* telemetry_task() took a tick, payload counter << 4 | altitude_period */
+        TRACE_RX_DROP, /* buf_push() refused a byte, payload the buffer */
+        TRACE_TX_DROP, /* buf_write() refused a block, payload its length */
+        TRACE_MESSAGE = 0x40, /* + MessageType: handler called, payload low byte of the value */
+        TRACE_SEND = 0x60, /* + OutMessageType: frame encoded, payload low byte of the value */
+    } TraceEvent;
+
+    typedef struct {
+        uint8_t event; /* TraceEvent */
+        uint8_t payload;
+        uint16_t time; /* timebase_phase() when the event was recorded */
+    } trace_entry_t;
+
+#if TRACE_SIZE
+    /* Records an event in the flight recorder. The main loop and both interrupt
+     * levels record, and with the compiled stack a shared function would have one
+     * frame for all of them, so this expands inline: the temporaries live in the
+     * caller's frame and the whole entry is written with interrupts disabled. */
+#define TRACE(ac, ev, pl) do { \
+        if (!(ac)->trace_frozen) { \
+            uint8_t trace_event_ = (ev); \
+            uint8_t trace_payload_ = (pl); \
+            uint8_t trace_gie_ = INTCONbits.GIE; \
+            INTCONbits.GIE = 0; \
+            trace_entry_t *trace_entry_ = &(ac)->trace[(ac)->trace_head & TRACE_MASK]; \
+            (ac)->trace_head++; \
+            if ((ac)->trace_count < TRACE_SIZE) { \
+                (ac)->trace_count++; \
+            } \
+            trace_entry_->event = trace_event_; \
+            trace_entry_->payload = trace_payload_; \
+            trace_entry_->time = timebase_phase(); \
+            INTCONbits.GIE = trace_gie_; \
+        } \
+    } while (0)
+#else
+#define TRACE(ac, ev, pl) ((void) 0)
+#endif
+
+    /* Layout of an outgoing frame: $ + id + digit_count hex digits + # */
+    typedef struct {
+        char id[3];
+        uint8_t digit_count;
+    } FrameLayout;
+
+#define FRAME_OVERHEAD 5    /* '$', 3-character ID and '#' */
+#define FRAME_MAX_LENGTH (FRAME_OVERHEAD + PROTOCOL_MAX_DIGITS)
+
+    /* Binary frames, used after $BIN01# is received, are laid out in protocol.h.
+     * The CRC-8 (polynomial 0x07, initial value 0) covers the type and the payload. */
+#define BINARY_OVERHEAD 3   /* Sync, type and CRC bytes */
+
+    void send_frame(aircraft_t *ac, OutMessageType type, uint32_t value);
+    uint16_t read_counter(volatile uint16_t *counter);
+    uint16_t read_stat(aircraft_t *ac, uint8_t counter);
+
+    /* **** Ring-buffers for incoming and outgoing data **** */
+
+    typedef enum {
+        INBUF = 0, OUTBUF = 1
+    } buf_t;
+
+#define INBUF_MASK (INBUF_SIZE - 1)     /* Wraps the indices, see the memory configuration */
+#define OUTBUF_MASK (OUTBUF_SIZE - 1)
+
+#if (INBUF_SIZE & INBUF_MASK) != 0 || INBUF_SIZE > 256 || (OUTBUF_SIZE & OUTBUF_MASK) != 0 || OUTBUF_SIZE > 256
+#error "INBUF_SIZE and OUTBUF_SIZE must be powers of two not larger than 256"
+#endif
+#if OUTBUF_SIZE <= TRACE_TX_BACKLOG + FRAME_MAX_LENGTH
+#error "OUTBUF_SIZE must hold the flight recorder backlog and a telemetry frame"
+#endif
+
+    typedef struct {
+        volatile uint8_t *data; /* inbuf_data or outbuf_data of the aircraft */
+        uint8_t mask; /* Size of data - 1 */
+        volatile uint8_t head; /* Next slot to push, written by the producer only */
+        volatile uint8_t tail; /* Next slot to pop, written by the consumer only */
+        volatile uint8_t high_water; /* Highest occupancy seen by the producer */
+        volatile uint16_t drops; /* Refused pushes and writes */
+    } ring_t;
+
+    /* **** Flight state **** */
+
+    /* Everything that describes one aircraft: the handlers, the ISRs and the
+     * tasks take it as their first argument instead of sharing globals, so the
+     * host can run many independent aircraft in one process. The fields used on
+     * every byte and tick come first, the rings last. The device has exactly one,
+     * and the vectors and main() pass AIRCRAFT. */
+    struct aircraft {
+        uint16_t dist;
+        uint16_t speed;
+        AltitudePeriod altitude_period;
+        uint8_t counter;
+        unsigned is_manual : 1;
+        unsigned binary_mode : 1; /* Frames are sent in binary and binary frames are accepted */
+        uint16_t adc; /* Last averaged ADC value */
+
+        uint8_t timebase_events; /* Compare events since the last tick */
+        volatile uint8_t ticks_posted; /* Ticks counted by timer_isr() */
+        uint8_t ticks_done; /* Ticks handled by telemetry_task() */
+        volatile uint8_t events; /* EVENT_* bits posted by the ISRs for the main loop */
+
+        ParseState parse_state;
+        MessageType message_type;
+        uint32_t message_key; /* Header characters packed as (c0 << 16) | (c1 << 8) | c2 */
+        uint8_t message_pos;
+        uint16_t parsed_number;
+        uint8_t digit_count_to_be_parsed;
+        uint8_t parsed_digit_count; /* Payload bytes instead of digits for binary frames */
+        uint8_t message_crc; /* CRC-8 of the binary frame being parsed */
+
+        uint8_t adc_sample_events; /* Timebase events since the last conversion was started */
+        uint16_t adc_tick_sum; /* Samples of the current tick, owned by the low priority ISRs */
+        uint8_t adc_tick_count;
+        /* Samples of the last tick, published with ticks_posted. The main loop reads
+         * the three together with the low priority interrupts masked. */
+        volatile uint16_t adc_snapshot_sum;
+        volatile uint8_t adc_snapshot_count;
+        uint32_t adc_period_sum; /* Samples of the current altitude period, owned by the main loop */
+        uint16_t adc_period_count;
+        uint8_t alt_band; /* Altitude band last reported by adc_to_alt(), ALT_BAND_NONE at start */
+
+        uint8_t portb_state; /* Debounced levels of RB4-RB7, in the PORTB bit positions */
+        uint8_t portb_count0; /* Vertical counter of the samples that differ from portb_state */
+        uint8_t portb_count1;
+        uint8_t portb_enable; /* BUTTON_RB* of the buttons whose LED is on */
+        volatile uint8_t portb_send; /* BUTTON_RB* of the released enabled buttons, cleared when PRS is sent */
+
+        uint32_t idle_counts; /* Timebase counts slept in the current CPU load window */
+        uint8_t load_ticks; /* Ticks in the current CPU load window */
+        uint16_t cpu_load; /* Permille of the last window spent awake */
+        volatile uint16_t uart_overruns; /* Counted by receive_isr() */
+        volatile uint16_t uart_framing_errors;
+
+        ring_t rings[2]; /* Preallocated rings for incoming and outgoing data */
+        volatile uint8_t inbuf_data[INBUF_SIZE];
+        volatile uint8_t outbuf_data[OUTBUF_SIZE];
+
+#if TRACE_SIZE
+        trace_entry_t trace[TRACE_SIZE]; /* Flight recorder, the next entry goes to trace_head & TRACE_MASK */
+        uint8_t trace_head;
+        uint8_t trace_count; /* Entries held, up to TRACE_SIZE */
+        uint8_t trace_dump; /* Next entry to stream while EVENT_TRACE is set */
+        volatile bool trace_frozen; /* Set during a dump, nothing is recorded */
+#endif
+    };
+
+#ifndef AIRCRAFT /* The host build defines it in its xc.h */
+    aircraft_t aircraft;
+#define AIRCRAFT (&aircraft)
+#endif
 
 
 #ifdef	__cplusplus
@@ -0,0 +1,147 @@
+/* Generated by protocol/generate.py from protocol/messages.json, do not edit */
+
+#ifndef PROTOCOL_H
+#define	PROTOCOL_H
+
+    /* Messages received by the plane */
+    typedef enum {
+        MT_GO, /* $GOO<4 digits># */
+        MT_END, /* $END# */
+        MT_SPEED, /* $SPD<4 digits># */
+        MT_ALTITUDE, /* $ALT<4 digits># */
+        MT_MANUAL, /* $MAN<2 digits># */
+        MT_LED, /* $LED<2 digits># */
+        MT_BINARY, /* $BIN<2 digits># */
+        MT_STATS, /* $STA# */
+        MT_TRACE, /* $TRC# */
+        MT_COUNT, /* Number of message types, also marks an unknown header */
+    } MessageType;
+
+    /* Messages sent by the plane */
+    typedef enum {
+        OUT_DISTANCE, /* $DST<4 digits># */
+        OUT_ALTITUDE, /* $ALT<4 digits># */
+        OUT_PRESS, /* $PRS<2 digits># */
+        OUT_STATS, /* $STA<6 digits># */
+        OUT_TRACE, /* $TRC<8 digits># */
+        OUT_COUNT,
+    } OutMessageType;
+
+#define PROTOCOL_MAX_DIGITS 8 /* Longest payload of any message, in hex digits */
+
+    /* Binary frames: BINARY_SYNC, type, payload (little-endian, digits / 2 bytes), CRC-8.
+     * The type is BINARY_TYPE_IN + MessageType for incoming messages and
+     * BINARY_TYPE_OUT + OutMessageType for outgoing ones. */
+#define BINARY_SYNC 0xA5
+#define BINARY_TYPE_IN 0x10
+#define BINARY_TYPE_OUT 0x20
+
+    /* Initializers of the FrameLayout tables, indexed by MessageType and OutMessageType */
+#define MESSAGE_LAYOUTS { \
+    [MT_GO] = {{'G', 'O', 'O'}, 4}, \
+    [MT_END] = {{'E', 'N', 'D'}, 0}, \
+    [MT_SPEED] = {{'S', 'P', 'D'}, 4}, \
+    [MT_ALTITUDE] = {{'A', 'L', 'T'}, 4}, \
+    [MT_MANUAL] = {{'M', 'A', 'N'}, 2}, \
+    [MT_LED] = {{'L', 'E', 'D'}, 2}, \
+    [MT_BINARY] = {{'B', 'I', 'N'}, 2}, \
+    [MT_STATS] = {{'S', 'T', 'A'}, 0}, \
+    [MT_TRACE] = {{'T', 'R', 'C'}, 0}, \
+}
+#define FRAME_LAYOUTS { \
+    [OUT_DISTANCE] = {{'D', 'S', 'T'}, 4}, \
+    [OUT_ALTITUDE] = {{'A', 'L', 'T'}, 4}, \
+    [OUT_PRESS] = {{'P', 'R', 'S'}, 2}, \
+    [OUT_STATS] = {{'S', 'T', 'A'}, 6}, \
+    [OUT_TRACE] = {{'T', 'R', 'C'}, 8}, \
+}
+
+    /* Open-addressing hash table from packed header key to MessageType, filled
+     * here so that the device keeps it in program memory. Collisions are probed
+     * linearly and MT_COUNT marks an empty slot. */
+#define HEADER_TABLE_SIZE 32
+#define HEADER_TABLE_MASK (HEADER_TABLE_SIZE - 1)
+#define HEADER_HASH(c0, c1, c2) ((uint8_t) ((c0) ^ ((c1) << 3) ^ ((c2) >> 1)) & HEADER_TABLE_MASK)
+#define HEADER_TABLE_KEYS { \
+    0, /* 0 */ \
+    0, /* 1 */ \
+    0x4D414E, /* 2 */ \
+    0, /* 3 */ \
+    0, /* 4 */ \
+    0x545243, /* 5 */ \
+    0x4C4544, /* 6 */ \
+    0, /* 7 */ \
+    0, /* 8 */ \
+    0, /* 9 */ \
+    0, /* 10 */ \
+    0x414C54, /* 11 */ \
+    0, /* 12 */ \
+    0x42494E, /* 13 */ \
+    0, /* 14 */ \
+    0, /* 15 */ \
+    0, /* 16 */ \
+    0x535044, /* 17 */ \
+    0, /* 18 */ \
+    0x535441, /* 19 */ \
+    0, /* 20 */ \
+    0, /* 21 */ \
+    0, /* 22 */ \
+    0x454E44, /* 23 */ \
+    0x474F4F, /* 24 */ \
+    0, /* 25 */ \
+    0, /* 26 */ \
+    0, /* 27 */ \
+    0, /* 28 */ \
+    0, /* 29 */ \
+    0, /* 30 */ \
+    0, /* 31 */ \
+}
+#define HEADER_TABLE_TYPES { \
+    MT_COUNT, /* 0 */ \
+    MT_COUNT, /* 1 */ \
+    MT_MANUAL, /* 2 */ \
+    MT_COUNT, /* 3 */ \
+    MT_COUNT, /* 4 */ \
+    MT_TRACE, /* 5 */ \
+    MT_LED, /* 6 */ \
+    MT_COUNT, /* 7 */ \
+    MT_COUNT, /* 8 */ \
+    MT_COUNT, /* 9 */ \
+    MT_COUNT, /* 10 */ \
+    MT_ALTITUDE, /* 11 */ \
+    MT_COUNT, /* 12 */ \
+    MT_BINARY, /* 13 */ \
+    MT_COUNT, /* 14 */ \
+    MT_COUNT, /* 15 */ \
+    MT_COUNT, /* 16 */ \
+    MT_SPEED, /* 17 */ \
+    MT_COUNT, /* 18 */ \
+    MT_STATS, /* 19 */ \
+    MT_COUNT, /* 20 */ \
+    MT_COUNT, /* 21 */ \
+    MT_COUNT, /* 22 */ \
+    MT_END, /* 23 */ \
+    MT_GO, /* 24 */ \
+    MT_COUNT, /* 25 */ \
+    MT_COUNT, /* 26 */ \
+    MT_COUNT, /* 27 */ \
+    MT_COUNT, /* 28 */ \
+    MT_COUNT, /* 29 */ \
+    MT_COUNT, /* 30 */ \
+    MT_COUNT, /* 31 */ \
+}
+
+    /* X(type, handler, argument) for every incoming message, argument being NONE,
+     * U8 or U16; RESET marks a handler that resets the system. See handle_message(). */
+#define MESSAGE_HANDLERS(X) \
+    X(MT_GO, get_go, U16) \
+    X(MT_END, get_end, RESET) \
+    X(MT_SPEED, get_speed, U16) \
+    X(MT_ALTITUDE, get_altitude, U16) \
+    X(MT_MANUAL, get_manual, U8) \
+    X(MT_LED, get_led, U8) \
+    X(MT_BINARY, get_binary, U8) \
+    X(MT_STATS, get_stats, NONE) \
+    X(MT_TRACE, get_trace, NONE) \
+
+#endif	/* PROTOCOL_H */
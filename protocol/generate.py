@@ -0,0 +1,265 @@
+#!/usr/bin/env python
+"""
+Generates both ends of the wire protocol from messages.json:
+
+    ../protocol.h            MessageType and OutMessageType, the binary framing
+                             constants, the frame layouts, the header lookup
+                             table and the handler dispatch of the firmware
+    ../simulator/protocol.py the same messages for cmds.py: BinaryType, one
+                             MessageSpec per message and the dicts its parser
+                             and encoders dispatch on
+
+"in" messages are sent to the plane and numbered as MessageType, "out" messages
+are sent by it and numbered as OutMessageType. A message has a 3-character ID
+and hex digit fields, most significant first; in a binary frame the fields are
+one little-endian number of digits / 2 bytes. An "in" message has at most one
+field of 2 or 4 digits, which is passed to its handler as uint8_t or uint16_t.
+
+Both outputs are committed, so neither build needs Python. Run this after
+changing messages.json (make protocol); --check only reports outdated outputs.
+
+Usage: python generate.py [--check]
+"""
+import json
+import os
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+SCHEMA = os.path.join(HERE, "messages.json")
+C_OUTPUT = os.path.join(HERE, "..", "protocol.h")
+PY_OUTPUT = os.path.join(HERE, "..", "simulator", "protocol.py")
+BANNER = "Generated by protocol/generate.py from protocol/messages.json, do not edit"
+
+MIN_HEADER_TABLE_SIZE = 16
+
+
+def header_hash(msg_id: str, size: int) -> int:
+    """
+    The firmware's HEADER_HASH, emitted into protocol.h below
+    """
+    c0, c1, c2 = (ord(c) for c in msg_id)
+    return ((c0 ^ (c1 << 3) ^ (c2 >> 1)) & 0xFF) & (size - 1)
+
+
+def digits(message: dict) -> int:
+    return sum(field["digits"] for field in message["fields"])
+
+
+def validate(schema: dict):
+    for direction in ("in", "out"):
+        names, ids = set(), set()
+        for message in schema[direction]:
+            where = f"{direction} message {message['name']}"
+            if len(message["id"]) != 3:
+                raise ValueError(f"{where}: the ID must have 3 characters")
+            if message["id"] in ids or message["name"] in names:
+                raise ValueError(f"{where}: duplicate name or ID")
+            ids.add(message["id"])
+            names.add(message["name"])
+            if any(field["digits"] % 2 for field in message["fields"]):
+                raise ValueError(f"{where}: binary frames need an even digit count")
+            if digits(message) > 8:
+                raise ValueError(f"{where}: more than 8 digits do not fit the 32-bit encoder")
+            if direction == "in" and (len(message["fields"]) > 1 or digits(message) not in (0, 2, 4)):
+                raise ValueError(f"{where}: handlers take a single field of 2 or 4 digits")
+
+
+def header_table(messages: list[dict]) -> list[int]:
+    """
+    Slot to MessageType index, len(messages) for an empty slot. Collisions are
+    probed linearly, as lookup_header() does.
+    """
+    size = MIN_HEADER_TABLE_SIZE
+    while size < 2 * len(messages):
+        size *= 2
+    table = [len(messages)] * size
+    for idx, message in enumerate(messages):
+        slot = header_hash(message["id"], size)
+        while table[slot] != len(messages):
+            slot = (slot + 1) & (size - 1)
+        table[slot] = idx
+    return table
+
+
+def c_chars(msg_id: str) -> str:
+    return "{" + ", ".join(f"'{c}'" for c in msg_id) + "}"
+
+
+def c_key(msg_id: str) -> str:
+    c0, c1, c2 = (ord(c) for c in msg_id)
+    return f"0x{(c0 << 16) | (c1 << 8) | c2:06X}"
+
+
+def generate_c(schema: dict) -> str:
+    ins, outs = schema["in"], schema["out"]
+    binary = schema["binary"]
+    table = header_table(ins)
+    max_digits = max(digits(m) for m in ins + outs)
+    lines = [
+        f"/* {BANNER} */",
+        "",
+        "#ifndef PROTOCOL_H",
+        "#define\tPROTOCOL_H",
+        "",
+        "    /* Messages received by the plane */",
+        "    typedef enum {",
+    ]
+    lines += [f"        MT_{m['name']}, /* ${m['id']}{'<' + str(digits(m)) + ' digits>' if digits(m) else ''}# */"
+              for m in ins]
+    lines += [
+        "        MT_COUNT, /* Number of message types, also marks an unknown header */",
+        "    } MessageType;",
+        "",
+        "    /* Messages sent by the plane */",
+        "    typedef enum {",
+    ]
+    lines += [f"        OUT_{m['name']}, /* ${m['id']}<{digits(m)} digits># */" for m in outs]
+    lines += [
+        "        OUT_COUNT,",
+        "    } OutMessageType;",
+        "",
+        f"#define PROTOCOL_MAX_DIGITS {max_digits} /* Longest payload of any message, in hex digits */",
+        "",
+        "    /* Binary frames: BINARY_SYNC, type, payload (little-endian, digits / 2 bytes), CRC-8.",
+        "     * The type is BINARY_TYPE_IN + MessageType for incoming messages and",
+        "     * BINARY_TYPE_OUT + OutMessageType for outgoing ones. */",
+        f"#define BINARY_SYNC {binary['sync']}",
+        f"#define BINARY_TYPE_IN {binary['type_in']}",
+        f"#define BINARY_TYPE_OUT {binary['type_out']}",
+        "",
+        "    /* Initializers of the FrameLayout tables, indexed by MessageType and OutMessageType */",
+        "#define MESSAGE_LAYOUTS { \\",
+    ]
+    lines += [f"    [MT_{m['name']}] = {{{c_chars(m['id'])}, {digits(m)}}}, \\" for m in ins]
+    lines += ["}", "#define FRAME_LAYOUTS { \\"]
+    lines += [f"    [OUT_{m['name']}] = {{{c_chars(m['id'])}, {digits(m)}}}, \\" for m in outs]
+    lines += [
+        "}",
+        "",
+        "    /* Open-addressing hash table from packed header key to MessageType, filled",
+        "     * here so that the device keeps it in program memory. Collisions are probed",
+        "     * linearly and MT_COUNT marks an empty slot. */",
+        f"#define HEADER_TABLE_SIZE {len(table)}",
+        "#define HEADER_TABLE_MASK (HEADER_TABLE_SIZE - 1)",
+        "#define HEADER_HASH(c0, c1, c2) ((uint8_t) ((c0) ^ ((c1) << 3) ^ ((c2) >> 1)) & HEADER_TABLE_MASK)",
+        "#define HEADER_TABLE_KEYS { \\",
+    ]
+    for slot, idx in enumerate(table):
+        lines.append(f"    {c_key(ins[idx]['id']) if idx < len(ins) else '0'}, /* {slot} */ \\")
+    lines += ["}", "#define HEADER_TABLE_TYPES { \\"]
+    for slot, idx in enumerate(table):
+        lines.append(f"    {'MT_' + ins[idx]['name'] if idx < len(ins) else 'MT_COUNT'}, /* {slot} */ \\")
+    lines += [
+        "}",
+        "",
+        "    /* X(type, handler, argument) for every incoming message, argument being NONE,",
+        "     * U8 or U16; RESET marks a handler that resets the system. See handle_message(). */",
+        "#define MESSAGE_HANDLERS(X) \\",
+    ]
+    for m in ins:
+        argument = "RESET" if m.get("resets") else {0: "NONE", 2: "U8", 4: "U16"}[digits(m)]
+        lines.append(f"    X(MT_{m['name']}, {m['handler']}, {argument}) \\")
+    lines += [
+        "",
+        "#endif\t/* PROTOCOL_H */",
+        "",
+    ]
+    return "\n".join(lines)
+
+
+def py_spec(direction: str, message: dict, type_base: int, idx: int) -> str:
+    fields = ", ".join(f"(\"{f['name']}\", {f['digits']})" for f in message["fields"])
+    if len(message["fields"]) == 1:
+        fields += ","
+    return (f"MessageSpec(b\"{message['id']}\", \"{direction}\", 0x{type_base + idx:02X}, "
+            f"({fields}), \"{message['class']}\")")
+
+
+def generate_py(schema: dict) -> str:
+    binary = schema["binary"]
+    type_in, type_out = int(binary["type_in"], 16), int(binary["type_out"], 16)
+    lines = [
+        f"# {BANNER}",
+        "from enum import IntEnum",
+        "from typing import NamedTuple",
+        "",
+        f"BINARY_SYNC = {binary['sync']}",
+        "BINARY_OVERHEAD = 3  # sync, type and CRC bytes",
+        "",
+        "",
+        "class BinaryType(IntEnum):",
+        "    \"\"\"",
+        "    Type bytes of the binary frames. Commands sent to the plane are numbered from",
+        f"    0x{type_in:02X} in the order of the firmware's MessageType, its reports from 0x{type_out:02X} in the",
+        "    order of OutMessageType.",
+        "    \"\"\"",
+    ]
+    lines += [f"    {m['name']} = 0x{type_in + idx:02X}" for idx, m in enumerate(schema["in"])]
+    lines += [f"    {m['name']}_REPORT = 0x{type_out + idx:02X}" for idx, m in enumerate(schema["out"])]
+    lines += [
+        "",
+        "",
+        "class MessageSpec(NamedTuple):",
+        "    \"\"\"",
+        "    One message of the protocol. fields are (attribute, hex digits) pairs, most",
+        "    significant first; in a binary frame they are one little-endian number.",
+        "    \"\"\"",
+        "    msg_id: bytes",
+        "    direction: str  # \"in\" is sent to the plane, \"out\" by it",
+        "    binary_type: int",
+        "    fields: tuple",
+        "    class_name: str  # Command subclass in cmds.py",
+        "",
+        "    @property",
+        "    def digits(self) -> int:",
+        "        return sum(d for _, d in self.fields)",
+        "",
+        "    @property",
+        "    def payload_size(self) -> int:",
+        "        return self.digits // 2",
+        "",
+        "",
+        "# In the order of MessageType, then OutMessageType",
+        "MESSAGES = (",
+    ]
+    lines += [f"    {py_spec('in', m, type_in, idx)}," for idx, m in enumerate(schema["in"])]
+    lines += [f"    {py_spec('out', m, type_out, idx)}," for idx, m in enumerate(schema["out"])]
+    lines += [
+        ")",
+        "",
+        "# (MSG ID, digit count) to spec, the same ID may be used with different digits",
+        "ASCII_SPECS = {(spec.msg_id, spec.digits): spec for spec in MESSAGES}",
+        "# Binary type byte to spec",
+        "BINARY_SPECS = {spec.binary_type: spec for spec in MESSAGES}",
+        "",
+    ]
+    return "\n".join(lines)
+
+
+def main():
+    check = "--check" in sys.argv[1:]
+    with open(SCHEMA) as f:
+        schema = json.load(f)
+    validate(schema)
+    outdated = []
+    for path, text in ((C_OUTPUT, generate_c(schema)), (PY_OUTPUT, generate_py(schema))):
+        try:
+            with open(path) as f:
+                current = f.read()
+        except FileNotFoundError:
+            current = None
+        if current == text:
+            continue
+        outdated.append(os.path.relpath(path, os.path.join(HERE, "..")))
+        if not check:
+            with open(path, "w") as f:
+                f.write(text)
+    if check and outdated:
+        print(f"Outdated, run protocol/generate.py: {', '.join(outdated)}")
+        sys.exit(1)
+    for path in outdated:
+        print(f"Generated {path}")
+
+
+if __name__ == "__main__":
+    main()
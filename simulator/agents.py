@@ -1,12 +1,14 @@
 import logging
-from queue import PriorityQueue
 import threading
-import time
+from collections import deque
 from enum import Enum, IntEnum
 from itertools import count
 
 from cmds import AltitudeCommand, AltitudePeriod, Command, DistanceCommand, EndCommand, LedCommand, LedValue, ManualCommand, PressCommand, SpeedCommand
 from commandqueue import CommandQueue
+from clock import get_clock, now
+from histogram import Histogram
+from testcase import ANY_ALTITUDE, DISTANCE_PER_PERIOD, CompiledTestCase
 from ui.enums import AltitudeZoneState
 
 logger = logging.getLogger("agents")
@@ -20,8 +22,15 @@ class Agent:
         # Unfortunate tight coupling...
         self.autopilot = autopilot
 
+    @property
+    def compiled(self) -> CompiledTestCase:
+        """
+        Period-indexed expectations of the test case being flown
+        """
+        return self.autopilot.compiled
+
     def relative_time(self):
-        return time.time() - self.agents_config.get("go-time", 0)
+        return now() - self.agents_config.get("go-time", 0)
 
     def to_real_time(self, relative_time: float):
         return relative_time + self.agents_config.get("go-time", 0)
@@ -36,7 +45,7 @@ class Agent:
         logger.warning(f"Not implemented")
 
     def send_command(self, cmd: Command):
-        self.autopilot.write(cmd)
+        self.autopilot.submit(cmd)
 
     def update_screen(self, update: object):
         self.autopilot.update_screen(update)
@@ -56,7 +65,18 @@ class ThreadedAgent(Agent):
         logger.warning(f"Not implemented")
 
     def start(self):
-        self.thread.start()
+        clock = get_clock()
+        if clock.virtual:
+            # Virtual time is advanced by one thread, the agent runs from it
+            self.attach(clock)
+        else:
+            self.thread.start()
+
+    def attach(self, clock):
+        """
+        Hooks the agent into a virtual clock instead of running its thread
+        """
+        logger.warning(f"Not implemented")
 
     def stop(self):
         self.alive = False
@@ -86,12 +106,28 @@ class CommandDispatcherAgent(ThreadedAgent):
                 # The mock command is put by stop() call
                 logger.debug(f"CommandDispatcherAgent thread is exiting.")
                 return
-            for a in self.sub_agents:
-                a: Agent
-                if pair == None:
-                    a.process_empty()
-                else:
-                    a.process_cmd(*pair)
+            self.dispatch(pair)
+
+    def dispatch(self, pair):
+        for a in self.sub_agents:
+            a: Agent
+            if pair == None:
+                a.process_empty()
+            else:
+                a.process_cmd(*pair)
+
+    def attach(self, clock):
+        clock.add_idle_hook(self.dispatch_pending)
+
+    def dispatch_pending(self):
+        """
+        Dispatches the queued commands without blocking, used with a virtual clock
+        """
+        while self.alive:
+            pair = self.cmd_queue.get_nowait()
+            if pair == None or type(pair[1]) == Command:
+                return
+            self.dispatch(pair)
 
     def stop(self):
         super().stop()
@@ -107,14 +143,104 @@ class CommandDispatcherAgent(ThreadedAgent):
         super().finish()
 
 
+class Alarm:
+    __slots__ = ("deadline", "seq", "on_alarm", "args", "kind", "tick", "cancelled")
+
+    def __init__(self, deadline: float, seq: int, on_alarm, args, kind: str):
+        self.deadline = deadline
+        self.seq = seq
+        self.on_alarm = on_alarm
+        self.args = args
+        self.kind = kind
+        self.tick = 0
+        self.cancelled = False
+
+
+class TimingWheel:
+    """
+    Hashed timing wheel. An alarm goes into the slot of its tick (deadline
+    divided by the resolution) modulo the wheel size, so insert and cancel are
+    O(1) at any distance; alarms more than one revolution away share slots
+    with nearer ones and are told apart by their absolute tick.
+    """
+
+    def __init__(self, resolution: float, size: int, start_time: float):
+        self.resolution = resolution
+        self.slots = [[] for _ in range(size)]
+        self.cursor = int(start_time // resolution)   # tick of the next slot to sweep
+        self.count = 0
+
+    def insert(self, alarm: Alarm):
+        # Alarms for the past go into the current slot and are due right away
+        alarm.tick = max(int(alarm.deadline // self.resolution), self.cursor)
+        self.slots[alarm.tick % len(self.slots)].append(alarm)
+        self.count += 1
+
+    def cancel(self, alarm: Alarm):
+        # Removed from its slot when the slot is swept
+        if not alarm.cancelled:
+            alarm.cancelled = True
+            self.count -= 1
+
+    def pop_due(self, timestamp: float) -> list[Alarm]:
+        """
+        Removes and returns the alarms due at timestamp, earliest first.
+        """
+        due = []
+        now_tick = int(timestamp // self.resolution)
+        while self.count > 0 and self.cursor <= now_tick:
+            slot = self.slots[self.cursor % len(self.slots)]
+            keep = []
+            for alarm in slot:
+                if alarm.cancelled:
+                    continue
+                if alarm.tick == self.cursor and alarm.deadline <= timestamp:
+                    due.append(alarm)
+                else:
+                    keep.append(alarm)
+            slot[:] = keep
+            if self.cursor == now_tick:
+                # The rest of this slot is due later within the tick
+                break
+            self.cursor += 1
+        if self.count == 0:
+            self.cursor = max(self.cursor, now_tick)
+        self.count -= len(due)
+        due.sort(key=lambda a: (a.deadline, a.seq))
+        return due
+
+    def next_deadline(self) -> float:
+        """
+        Returns the earliest deadline, None if the wheel is empty.
+        """
+        if self.count == 0:
+            return None
+        size = len(self.slots)
+        for tick in range(self.cursor, self.cursor + size):
+            deadlines = [a.deadline for a in self.slots[tick % size]
+                         if a.tick == tick and not a.cancelled]
+            if deadlines:
+                return min(deadlines)
+        # Everything is more than one revolution away
+        return min(a.deadline for slot in self.slots for a in slot if not a.cancelled)
+
+    def pending(self) -> list[Alarm]:
+        return [a for slot in self.slots for a in slot if not a.cancelled]
+
+
 class AlarmAgent(ThreadedAgent):
     """
     Makes best use of a single thread for creating alarms.
-    Not tested, might be buggy.
+    Alarms are kept in a timing wheel on the shared monotonic clock, and the
+    lateness of every delivery is recorded per alarm kind.
 
     TODO Make this a proper singleton
     """
     ALARM_ERROR_THRESHOLD = 0.1   # second(s) error margin
+    WHEEL_RESOLUTION = 0.005      # seconds per slot
+    WHEEL_SIZE = 512              # slots, one revolution is 2.56 seconds
+    LATENESS_BUCKET = 0.0001      # seconds, histogram resolution
+    LATENESS_BUCKETS = 2000       # up to 200 ms
     _INSTANCE = None
     unique = count()
 
@@ -127,76 +253,221 @@ class AlarmAgent(ThreadedAgent):
 
     def __init__(self, *args, **kwargs):
         super().__init__(*args, **kwargs)
-        self.alarms = PriorityQueue()
+        self.wheel = TimingWheel(AlarmAgent.WHEEL_RESOLUTION, AlarmAgent.WHEEL_SIZE, now())
+        self.lateness: dict[str, Histogram] = {}
         # RLock is needed as the users may add alarms during an alarm
         self.sleep_lock = threading.RLock()
         self.sleep_cv = threading.Condition(self.sleep_lock)
-        self.wake_time = time.time() * 2  # FIXME
         self.start()
 
-    def add_alarm(self, on_alarm, timestamp: float, args=[]):
-        if timestamp < time.time():
+    def add_alarm(self, on_alarm, timestamp: float, args=[], kind: str = None) -> Alarm:
+        """
+        Schedules on_alarm(*args) at timestamp. The kind names the alarm in the
+        lateness report and defaults to the callback's name.
+        Returns a handle for cancel_alarm().
+        """
+        if timestamp < now():
             logger.critical(f"Add alarm received an alarm for past!")
-        try:
-            self.alarms.put((timestamp, next(AlarmAgent.unique), on_alarm, args))
-        except TypeError as ex:
-            logger.critical(
-                f"Failure to put an alarm into the queue!\n" +
-                f"Details: {repr(ex)}")
-            raise ex
-        # Update the thread
-        self.wake_time = self.alarms.queue[0][0]
-        logger.debug(f"AlarmAgent new wake time is {self.wake_time}")
+        if kind is None:
+            owner = getattr(on_alarm, "__self__", None)
+            kind = on_alarm.__qualname__ if owner is None else \
+                f"{type(owner).__name__}.{on_alarm.__name__}"
+        alarm = Alarm(timestamp, next(AlarmAgent.unique), on_alarm, args, kind)
         with self.sleep_cv:
+            self.wheel.insert(alarm)
+            logger.debug(f"AlarmAgent added {kind} for {timestamp}")
             # Wake it up so that it waits until the new wake time instead
             self.sleep_cv.notify()
+        return alarm
+
+    def cancel_alarm(self, alarm: Alarm):
+        with self.sleep_lock:
+            self.wheel.cancel(alarm)
 
     def process_queue(self):
         with self.sleep_lock:
-            while not self.alarms.empty():
-                if self.alarms.queue[0][0] <= time.time():
-                    # Get removes it from the priority queue
-                    ts, _, on_alarm, args = self.alarms.get()
-                    logger.debug(f"AlarmAgent runs an alarm at {ts}")
-                    on_alarm(*args)
-                    if abs(ts - time.time()) > AlarmAgent.ALARM_ERROR_THRESHOLD:
-                        logger.critical(f"Alarm was delivered at an erroneous time! " +
-                                        f"Expected {ts}, delivered on {time.time()}")
-                else:
-                    self.wake_time = self.alarms.queue[0][0]
-                    logger.debug(
-                        f"AlarmAgent new wake time is {self.wake_time}")
+            while True:
+                due = self.wheel.pop_due(now())
+                if not due:
                     return
-            self.wake_time = time.time() * 2  # FIXME
+                # Alarms added by these callbacks are picked up by the next round
+                for alarm in due:
+                    logger.debug(f"AlarmAgent runs an alarm at {alarm.deadline}")
+                    alarm.on_alarm(*alarm.args)
+                    lateness = now() - alarm.deadline
+                    self._record_lateness(alarm.kind, lateness)
+                    if abs(lateness) > AlarmAgent.ALARM_ERROR_THRESHOLD:
+                        logger.critical(f"Alarm was delivered at an erroneous time! " +
+                                        f"Expected {alarm.deadline}, delivered on {now()}")
+
+    def _record_lateness(self, kind: str, lateness: float):
+        histogram = self.lateness.get(kind)
+        if histogram is None:
+            histogram = self.lateness[kind] = Histogram(
+                AlarmAgent.LATENESS_BUCKET, AlarmAgent.LATENESS_BUCKETS)
+        histogram.add(lateness)
 
     def worker(self):
         while self.alive:
             with self.sleep_cv:
-                timeout = self.wake_time - time.time()
-                if timeout < 0:
-                    logger.critical(
-                        f"Timeout is less than 0! Wake time: {self.wake_time}. Processing the queue immediately.")
-                    self.process_queue()
-                self.sleep_cv.wait(timeout)
+                wake_time = self.wheel.next_deadline()
+                # Without alarms, sleep until one is added
+                timeout = None if wake_time is None else wake_time - now()
+                if timeout is None or timeout > 0:
+                    self.sleep_cv.wait(timeout)
             if self.alive:
                 # If finished, do not process the queue. Anything added between finish() and now is garbage.
                 self.process_queue()
 
+    def attach(self, clock):
+        clock.add_source(self)
+
+    def next_event_time(self):
+        if not self.alive:
+            return None
+        return self.wheel.next_deadline()
+
+    def run_due(self):
+        self.process_queue()
+
+    def report(self):
+        """
+        Logs the delivery lateness per alarm kind, in milliseconds
+        """
+        if not self.lateness:
+            return
+        lines = [f"{'alarm':<44} {'count':>6} {'p50':>8} {'p99':>8} {'max':>8}"]
+        for kind in sorted(self.lateness):
+            h = self.lateness[kind]
+            lines.append(f"{kind:<44} {h.count:>6} {h.percentile(50) * 1000:>8.2f} " +
+                         f"{h.percentile(99) * 1000:>8.2f} {h.max * 1000:>8.2f}")
+        logger.info("AlarmAgent delivery lateness (ms):\n" + "\n".join(lines))
+
     def finish(self):
         # NOTE Finishing this does not make much sense.
         # Make it not alive
         self.stop()
         # Empty the queue
-        while not self.alarms.empty():
-            ts, _, on_alarm = self.alarms.get()
-            logger.warning(
-                f"An alarm of {on_alarm} scheduled for {ts} is being discarded because alarm agent has finished.")
+        with self.sleep_lock:
+            for alarm in self.wheel.pending():
+                logger.warning(
+                    f"An alarm of {alarm.kind} scheduled for {alarm.deadline} is being discarded because alarm agent has finished.")
+                self.wheel.cancel(alarm)
+        self.report()
         # Wake it up so that it exits
         with self.sleep_cv:
             self.sleep_cv.notify()
 
     def is_empty(self):
-        return self.alarms.empty()
+        return self.wheel.count == 0
+
+
+class WriterAgent(ThreadedAgent):
+    """
+    Coalesces the commands of the agents into one serial write per period.
+    submit() only appends to a deque, whose append and popleft are atomic, so
+    the agents never wait for the port or for each other. At write_offset
+    seconds after every period boundary the writer takes whatever is queued,
+    encodes it into one buffer and writes it with a single call, so the plane
+    gets its input as one burst at a known phase of the period.
+
+    The time from submit() to the write is recorded per command type.
+    """
+    LATENCY_BUCKET = 0.0001      # seconds, histogram resolution
+    LATENCY_BUCKETS = 2000       # up to 200 ms
+
+    def __init__(self, write_offset: float, *args, **kwargs):
+        super().__init__(*args, **kwargs)
+        self.period = self.agents_config["period"]
+        self.write_offset = write_offset
+        if not 0 <= write_offset < self.period:
+            logger.critical(f"Write offset {write_offset} is outside of the period {self.period}")
+        self.pending = deque()      # (submit time, command)
+        self.flush_lock = threading.Lock()
+        self.wake = threading.Event()
+        self.latency: dict[str, Histogram] = {}
+        self.writes = 0
+        self.written = 0
+        self.start()
+
+    def submit(self, cmd: Command):
+        self.pending.append((now(), cmd))
+        if not self.alive:
+            # Finished, nothing is going to flush it later
+            self.flush()
+
+    def flush_time(self, timestamp: float) -> float:
+        """
+        Returns the first flush after timestamp, period boundary + write_offset
+        """
+        relative = self.to_relative_time(timestamp) - self.write_offset
+        return self.to_real_time((int(relative // self.period) + 1) * self.period + self.write_offset)
+
+    def flush(self):
+        """
+        Writes everything queued so far in one call
+        """
+        with self.flush_lock:
+            batch = []
+            while self.pending:
+                batch.append(self.pending.popleft())
+            if not batch:
+                return
+            self.autopilot.write(b"".join(self.autopilot.encode(cmd) for _, cmd in batch))
+            written_at = now()
+            self.writes += 1
+            self.written += len(batch)
+            for submitted_at, cmd in batch:
+                kind = type(cmd).__name__
+                histogram = self.latency.get(kind)
+                if histogram is None:
+                    histogram = self.latency[kind] = Histogram(
+                        WriterAgent.LATENCY_BUCKET, WriterAgent.LATENCY_BUCKETS)
+                histogram.add(written_at - submitted_at)
+
+    def worker(self):
+        while self.alive:
+            timeout = self.flush_time(now()) - now()
+            if timeout > 0 and self.wake.wait(timeout):
+                # Woken up by stop()
+                break
+            self.flush()
+
+    def attach(self, clock):
+        clock.add_source(self)
+
+    def next_event_time(self):
+        # Without a queued command there is nothing to wake up for
+        if not self.pending:
+            return None
+        return self.flush_time(self.pending[0][0])
+
+    def run_due(self):
+        self.flush()
+
+    def stop(self):
+        super().stop()
+        self.wake.set()
+
+    def report(self):
+        """
+        Logs the submit-to-write latency per command type, in milliseconds
+        """
+        if not self.writes:
+            return
+        lines = [f"{'command':<24} {'count':>6} {'p50':>8} {'p99':>8} {'max':>8}"]
+        for kind in sorted(self.latency):
+            h = self.latency[kind]
+            lines.append(f"{kind:<24} {h.count:>6} {h.percentile(50) * 1000:>8.2f} " +
+                         f"{h.percentile(99) * 1000:>8.2f} {h.max * 1000:>8.2f}")
+        logger.info(f"WriterAgent wrote {self.written} commands in {self.writes} writes, latency (ms):\n" +
+                    "\n".join(lines))
+
+    def finish(self):
+        # Calls stop(), then sends what is left, e.g. the END of DistanceAgent
+        super().finish()
+        self.flush()
+        self.report()
 
 
 class PeriodStatus(IntEnum):
@@ -367,7 +638,7 @@ class DistanceAgent(PeriodicAgent):
         self.period_status = PeriodStatus.IGNORED
 
     def send_speed_cmd(self):
-        speed_cmd = SpeedCommand(10)    # TODO Add other distance calculation strategies
+        speed_cmd = SpeedCommand(DISTANCE_PER_PERIOD)    # TODO Add other distance calculation strategies
         self.remaining_distance -= speed_cmd.speed
         self.send_command(speed_cmd)
 
@@ -400,6 +671,13 @@ class DistanceAgent(PeriodicAgent):
         super().notify_overriden(period_no, timestamp, overrider_type_name)
         self.send_speed_cmd()
 
+    def on_period_finished(self, timestamp: float, period_number: int):
+        if self.period_status == PeriodStatus.MISSED:
+            # The plane has flown the period all the same, keep the expected distance
+            # in step so that one missed frame is one error and not all the rest
+            self.send_speed_cmd()
+        return super().on_period_finished(timestamp, period_number)
+
 
 class AltitudeAgent(PeriodicAgent):
     def __init__(self, turbulence_number: int, *args, **kwargs):
@@ -495,29 +773,21 @@ class AltitudeControlEventType(str, Enum):
 
 
 class AltitudeControllerAgent(PeriodicAgent):
+    """
+    Sends the altitude periods of its control and checks the ALT frames. What
+    to send and expect in each period comes from the compiled test case.
+    """
     # If some altitude is expected but its value does not matter use this
-    ANY_ALTITUDE = -1
+    ANY_ALTITUDE = ANY_ALTITUDE
 
     def __init__(self, controller_idx: int, *args, **kwargs):
         super().__init__(*args, **kwargs)
         self.controller_idx = controller_idx
         config = self.agents_config["altitude-controls"][controller_idx]
-        self.events = config["events"]
         self.enter = config["enter"]
         self.exit = config["exit"]
-        self.events_finished = False
-        self.period = self.agents_config["period"]
         AlarmAgent.instance().add_alarm(self.on_enter, self.to_real_time(self.enter))
         AlarmAgent.instance().add_alarm(self.on_exit, self.to_real_time(self.exit))
-        # Keep track of which events occurred and their progress
-        self.last_freq: AltitudePeriod = AltitudePeriod.ALT_000
-        self.last_freq_period: int = -1
-        self.curr_zone_no: int = -1
-        # Events with count field take multiple periods. Where in that are we?
-        self.curr_progress: int = 0
-        self.curr_event_idx: int = 0
-        # Set on on_period_finished
-        self.next_expected_altitude: int = None
 
     def on_enter(self):
         logger.info(f"AltitudeControllerAgent no {self.controller_idx} enters, stopping incoming altitude commands")
@@ -530,7 +800,7 @@ class AltitudeControllerAgent(PeriodicAgent):
         self.update_screen({"altitude-controls": False})
 
     def attempt_cmd(self, timestamp: float, period_number: int, cmd: Command) -> PeriodStatus:
-        if not self.enter < timestamp < self.exit:
+        if self.compiled.controller_at(period_number) != self.controller_idx:
             # Ignore all the messages and do not log anything
             self.period_status = PeriodStatus.MISSED
             return PeriodStatus.IGNORED
@@ -539,11 +809,12 @@ class AltitudeControllerAgent(PeriodicAgent):
             # Update screen
             self.update_screen({"altitude": cmd.altitude})
             # Check whether we expect a command and the altitude value
-            if self.next_expected_altitude == None:
+            expected_altitude = self.compiled.expected_altitude(period_number)
+            if expected_altitude == None:
                 self.period_status = PeriodStatus.IGNORED
-            elif self.next_expected_altitude == AltitudeControllerAgent.ANY_ALTITUDE:
+            elif expected_altitude == AltitudeControllerAgent.ANY_ALTITUDE:
                 self.period_status = PeriodStatus.SUCCESS
-            elif self.next_expected_altitude != cmd.altitude:
+            elif expected_altitude != cmd.altitude:
                 logger.error(f"AltitudeControllerAgent no {self.controller_idx} has failed period {period_number} at {timestamp}")
                 self.period_status = PeriodStatus.FAILURE
             else:
@@ -553,90 +824,44 @@ class AltitudeControllerAgent(PeriodicAgent):
         return PeriodStatus.IGNORED
     
     def on_period_finished(self, timestamp: float, period_number: int):
-        if not self.enter < timestamp < self.exit:
+        compiled = self.compiled
+        if compiled.controller_at(period_number) != self.controller_idx:
             # Ignore and do not print
             return
-        if self.next_expected_altitude == None and self.period_status == PeriodStatus.MISSED:
+        expected_altitude = compiled.expected_altitude(period_number)
+        if expected_altitude == None and self.period_status == PeriodStatus.MISSED:
             self.period_status = PeriodStatus.IGNORED
         # Update screen
+        zone_no = compiled.zone_at(period_number)
         if self.period_status == PeriodStatus.FAILURE or self.period_status == PeriodStatus.MISSED:
-            self.update_screen({"altitude-zone": {"controller-no": self.controller_idx, "zone-no": self.curr_zone_no, "state": AltitudeZoneState.BAD_STATE}})
-        elif self.period_status == PeriodStatus.SUCCESS and self.next_expected_altitude != AltitudeControllerAgent.ANY_ALTITUDE:
+            self.update_screen({"altitude-zone": {"controller-no": self.controller_idx, "zone-no": zone_no, "state": AltitudeZoneState.BAD_STATE}})
+        elif self.period_status == PeriodStatus.SUCCESS and expected_altitude != AltitudeControllerAgent.ANY_ALTITUDE:
             # If expected altitude is any then this is not an altitude zone but a free zone
-            self.update_screen({"altitude-zone": {"controller-no": self.controller_idx, "zone-no": self.curr_zone_no, "state": AltitudeZoneState.GOOD_STATE}})
-        # Process current event and set next_expected_altitude if not finished the events
-        if self.events_finished:
-            self.calculate_next_expected_altitude(period_number + 1, AltitudeControllerAgent.ANY_ALTITUDE)
-            # No event processing, just evaluate period status
-            return super().on_period_finished(timestamp, period_number)
-        try:
-            curr_event = self.events[self.curr_event_idx]
-        except IndexError as ex:
-            logger.critical(f"AltitudeControllerAgent has an index error: {repr(ex)}")
-            raise ex
-        if curr_event["type"] == AltitudeControlEventType.FREQ:
-            # Send frequency message
-            value = curr_event["value"]
-            logger.debug(f"AltitudeControllerAgent no {self.controller_idx} sends freq event for period {value} at {timestamp}. " + 
-                         f"Event no {curr_event}")
-            self.send_command(AltitudeCommand(curr_event["value"]))
-            self.last_freq = curr_event["value"]
-            self.last_freq_period = period_number
+            self.update_screen({"altitude-zone": {"controller-no": self.controller_idx, "zone-no": zone_no, "state": AltitudeZoneState.GOOD_STATE}})
+        # Send the frequency of a freq event
+        freq = compiled.command_at(period_number)
+        if freq is not None:
+            logger.debug(f"AltitudeControllerAgent no {self.controller_idx} sends freq event for period {freq} at {timestamp}.")
+            self.send_command(AltitudeCommand(freq))
             self.period_status = PeriodStatus.IGNORED
-            self.curr_event_idx += 1
-            # Update the next expected altitude
-            self.calculate_next_expected_altitude(period_number + 1, -2)    # -2 for debugging just in case
-        elif curr_event["type"] == AltitudeControlEventType.FREE:
-            # Progress it
-            self.curr_progress += 1
-            if self.curr_progress == curr_event["count"]:
-                # Finished progressing this event
-                self.curr_event_idx += 1
-                self.curr_progress = 0
-            # # Calculate for the next period
-            self.calculate_next_expected_altitude(period_number + 1, AltitudeControllerAgent.ANY_ALTITUDE)
-        elif curr_event["type"] == AltitudeControlEventType.ALTITUDE:
-            if self.curr_progress == 0:
-                # We entered a new altitude zone
-                self.curr_zone_no += 1
-            if self.last_freq_period == -1:
-                logger.critical(f"Period number of last frequency is -1! Make sure your test case is valid.")
-            if self.last_freq == AltitudePeriod.ALT_000:
-                logger.critical(f"Last frequency is 0! Make sure your test case is valid.")
-            # Calculate for the next period
-            self.calculate_next_expected_altitude(period_number + 1, curr_event["value"])
-            # Progress it
-            self.curr_progress += 1
-            if self.curr_progress == curr_event["count"]:
-                self.curr_event_idx += 1
-                self.curr_progress = 0
-        if self.curr_event_idx == len(self.events):
-            logger.debug(f"AltitudeControllerAgent no {self.controller_idx} finished progressing all of its events.")
-            self.events_finished = True
         return super().on_period_finished(timestamp, period_number)
 
-    def calculate_next_expected_altitude(self, next_period_number, expected_altitude: int):
-        if self.last_freq == AltitudePeriod.ALT_000:
-            # No reading is expected
-            self.next_expected_altitude = None
-        # Distance of two expected altitude commands in period counts 
-        period_count = round(self.last_freq / 1000 / self.period * 10)/10
-        if (next_period_number - self.last_freq_period) % period_count == 0:
-            # We need to get an altitude command on the next period
-            self.next_expected_altitude = expected_altitude
-        else:
-            # We are NOT expecting an altitude command on the next period
-            self.next_expected_altitude = None
 
 class LedAgent(PeriodicAgent):
     _DEFAULT_REMOVE_TIMEOUT = 3    # secs
     LED_2_BUTTON = {1: 4, 2: 5, 3: 6, 4: 7}
+    BUTTON_2_LED = {button: led for led, button in LED_2_BUTTON.items()}
 
-    def __init__(self, start_time: float, led: LedValue, *args, **kwargs):
+    def __init__(self, start_time: float, led: LedValue, entry: int, *args, **kwargs):
+        """
+        entry is the index of the LED in the test case's manual.leds, its
+        periods in the compiled test case
+        """
         super().__init__(*args, **kwargs)
         if led not in LedAgent.LED_2_BUTTON:
             logger.critical(f"Led number {led} is invalid!")
         self.led = led
+        self.entry = entry
         self.satisfied = False
         self.add_time = start_time
         AlarmAgent.instance().add_alarm(self.on_add_alarm, self.to_real_time(self.add_time))
@@ -669,7 +894,7 @@ class LedAgent(PeriodicAgent):
 
     def attempt_cmd(self, timestamp: float, period_number: int, cmd: Command) -> PeriodStatus:
         # NOTE I chose to allow multiple presses for one agent
-        if not self.add_time < timestamp < self.remove_time:
+        if not self.compiled.led_at(period_number, self.entry):
             # We are not yet handling it
             return PeriodStatus.IGNORED
         if type(cmd) == PressCommand:
@@ -683,8 +908,14 @@ class LedAgent(PeriodicAgent):
                     logger.info(
                         f"Led task of led {self.led} at {self.add_time} was already satisfied.")
                 self.satisfied = True
+                if self.led in self.compiled.leds_awaited(period_number, below=self.entry):
+                    # An earlier entry of the same LED is still open, the press is its as well
+                    return PeriodStatus.IGNORED
                 # Turn the led off immediately
                 self.send_command(LedCommand(LedValue.LED_0))
+            elif LedAgent.BUTTON_2_LED.get(cmd.button) in self.compiled.leds_awaited(period_number):
+                # The press of another LED awaited at the same time, its agent takes it
+                return PeriodStatus.IGNORED
             else:
                 # Pressed wrong button
                 self.period_status = PeriodStatus.FAILURE
@@ -694,7 +925,7 @@ class LedAgent(PeriodicAgent):
         return PeriodStatus.IGNORED
 
     def on_period_finished(self, timestamp: float, period_number: int):
-        if not self.add_time < timestamp < self.remove_time:
+        if not self.compiled.led_at(period_number, self.entry):
             # Ignore this period, do not print anything
             return
         if self.period_status == PeriodStatus.MISSED:
@@ -723,9 +954,9 @@ class ManualAgent(Agent):
         self.send_command(ManualCommand(1))
         self.update_screen({"manual": True})
         # Create and register LedAgents
-        for led_info in self.agents_config["manual"]["leds"]:
+        for entry, led_info in enumerate(self.agents_config["manual"]["leds"]):
             led = LedAgent(led_info["start-time"],
-                           led_info["button"],
+                           led_info["button"], entry,
                            self.agents_config, self.autopilot)
             self.leds.append(led)
             self.periodicity_agent.add_periodic_agent(led)
@@ -1,16 +1,24 @@
 #!/usr/bin/env python
-import time
+import argparse
+import copy
 import threading
+import time
 import serial
+import sys
 import json
 import logging
+from cadence import CadenceAnalyzer, write_fleet_report
 from cmds import *
+from clock import VirtualClock, get_clock, set_clock
 from commandqueue import CommandQueue
-from screen import Screen
+from flightrecorder import TraceDecoder, TraceEntry, format_timeline
+from screen import HeadlessScreen, Screen
+from session import FROM_PLANE, TO_PLANE, ReplayPort, SessionRecorder, load_session
+from testcase import CompiledTestCase, compile_testcase, load_compiled
+from virtualplane import VirtualPlane
 from enum import Enum
 from pygame import locals as pygame_locals
 from pygame.event import Event
-import re
 from agents import *
 
 
@@ -35,18 +43,35 @@ class SimulatorMode(Enum):
 with open("autopilot-settings.json", "r") as f:
     SETTINGS = json.loads(f.read())
 
-# Load test case, which is agents_config
-with open("test-case-0.json", 'r') as f:
-    lines = f.readlines()
-    lines = [line for line in lines if not re.search(r'//', line)]
-    TESTCASE = json.loads("\n".join(lines))
 
-print(TESTCASE)
+# Load test case, which is agents_config, and its period-indexed expectations
+COMPILED: CompiledTestCase = load_compiled("test-case-0.json")
+TESTCASE = COMPILED.config
 
 FPS = SETTINGS["FPS"]
 PORT = SETTINGS["PORT"]
 BAUDRATE = SETTINGS["BAUDRATE"]
 LOG_LEVEL = SETTINGS["LOG_LEVEL"]
+# Without a window, the flight starts right away instead of waiting for "s"
+HEADLESS = SETTINGS.get("HEADLESS", False)
+# "real" talks to the board on PORT, "virtual" flies the host build of the
+# firmware in virtual time (implies HEADLESS)
+CLOCK = SETTINGS.get("CLOCK", "real")
+VIRTUAL_ADC = SETTINGS.get("VIRTUAL_ADC", 512)
+BINARY_FRAMES = SETTINGS.get("BINARY_FRAMES", False)
+# Frame arrival timing is written to <prefix>.csv and <prefix>.json if a prefix is given
+CADENCE_REPORT = SETTINGS.get("CADENCE_REPORT", None)
+# Seconds between $STA# queries of the plane's buffer and UART counters, 0 disables them
+STATS_INTERVAL = SETTINGS.get("STATS_INTERVAL", 0)
+# Seconds after GO to dump the plane's flight recorder with $TRC#, the timelines
+# are logged and written to <prefix>-<n>.txt, a null prefix only logs them
+TRACE_AT = SETTINGS.get("TRACE_AT", [])
+TRACE_REPORT = SETTINGS.get("TRACE_REPORT", "trace-report")
+# Seconds after each period boundary at which the commands of the agents are
+# written, all of a period's in one write; null writes each one when it is sent
+WRITE_OFFSET = SETTINGS.get("WRITE_OFFSET", 0.06)
+# Every byte to and from the plane is recorded to <prefix>.session, null disables it
+RECORD = SETTINGS.get("RECORD", None)
 WAITING = 0
 GETTING = 1
 timeout = 100
@@ -55,13 +80,61 @@ CMD_GET_TIMEOUT = CMD_PERIOD * 1.1  # seconds
 logging.basicConfig(level=getattr(logging, LOG_LEVEL))
 
 
+class ErrorCounter(logging.Handler):
+    """
+    Counts the errors logged during a run, a headless run that logged any exits with 1
+    """
+    def __init__(self):
+        super().__init__(logging.ERROR)
+        self.count = 0
+
+    def emit(self, record: logging.LogRecord):
+        self.count += 1
+
+
+ERRORS = ErrorCounter()
+logging.getLogger().addHandler(ERRORS)
+
+
+def flight_timeout(compiled: CompiledTestCase) -> float:
+    """
+    Seconds to wait for a flight to reach distance 0, with slack for a late plane
+    """
+    return max(100, compiled.flight_time() + 20)
+
+
 class AutoPilot:
-    def __init__(self, port, baudrate, parity, rtscts, xonxoff):
+    def __init__(self, port, baudrate, parity, rtscts, xonxoff, headless=False,
+                 cadence_report=None, stats_interval=0, testcase=None, compiled=None, on_finish=None,
+                 trace_at=(), trace_report=None, write_offset=None, record=None, port_stand_in=None,
+                 binary_frames=None):
+        """
+        testcase and compiled default to the loaded TESTCASE and COMPILED. The
+        commands of the agents are batched by a WriterAgent if write_offset is
+        not None (see submit()). The traffic of the flight is recorded to
+        <record>.session if record is given. port_stand_in replaces the serial
+        port, e.g. with a session.ReplayPort that calls receive() itself. If
+        on_finish is given, it is called with the AutoPilot when the flight has
+        finished instead of stopping the clock and writing the cadence report
+        (see Fleet).
+        """
         logging.info("AutoPilot initialization")
-        self.serial = serial.Serial(port, baudrate, parity=parity,
-                                    rtscts=rtscts, xonxoff=xonxoff,
-                                    timeout=10  # 10 secs timeout
-                                    )
+        self.testcase = TESTCASE if testcase is None else testcase
+        self.compiled = COMPILED if compiled is None else compiled
+        self.on_finish = on_finish
+        self.virtual = get_clock().virtual
+        if port_stand_in is not None:
+            self.serial = port_stand_in
+        elif self.virtual:
+            # The firmware runs in this process and calls receive() itself
+            self.serial = VirtualPlane(get_clock(), baudrate,
+                                       receiver=self.receive, adc=VIRTUAL_ADC)
+        else:
+            self.serial = serial.Serial(port, baudrate, parity=parity,
+                                        rtscts=rtscts, xonxoff=xonxoff,
+                                        timeout=10  # 10 secs timeout
+                                        )
+        self.headless = headless or self.virtual
         self.mode = SimulatorMode.IDLE
         self.mode_lock = threading.Lock()
         self.mode_cv = threading.Condition(self.mode_lock)
@@ -71,15 +144,34 @@ class AutoPilot:
         self.alive = True
         self.reader_thread = threading.Thread(target=self.reader_worker)
         self.reader_thread.daemon = True
-        self.reader_thread.start()
         self.cmd_buffer = CMDBuffer()
         self.cmd_queue = CommandQueue(CMD_GET_TIMEOUT)
+        self.cadence_report = cadence_report
+        self.cadence = None
+        # Plane counters, latest StatsCommand value by StatsCounter
+        self.stats_interval = stats_interval
+        self.stats_alarm = None
+        self.plane_stats = {}
+        # Flight recorder dumps requested at trace_at seconds after GO
+        self.trace_at = trace_at
+        self.trace_report = trace_report
+        self.trace_alarms = []
+        self.trace_decoder = TraceDecoder(self.testcase["period"])
+        if not self.virtual:
+            self.reader_thread.start()
 
         # Writer
         self.writer_lock = threading.Lock()
+        self.binary_frames = False  # set once the binary framing handshake is sent
+        self.write_offset = write_offset
+        self.writer = None
+        self.binary_frames_wanted = BINARY_FRAMES if binary_frames is None else binary_frames
+        self.baudrate = baudrate
+        self.record = record
+        self.recorder = None
 
         # UI
-        self.screen = Screen()
+        self.screen = HeadlessScreen() if self.headless else Screen()
         self.screen.start()
         self.screen.add_keyboard_handler(self.screen_keyboard_handler)
 
@@ -90,32 +182,40 @@ class AutoPilot:
     def reader_worker(self):
         logging.info("AutoPilot reader thread has begun")
         while self.alive:
-            byte = self.serial.read()
-            if len(byte) == 0:
+            # Block for the first byte, then take everything that has arrived
+            data = self.serial.read(max(1, self.serial.in_waiting))
+            if len(data) == 0:
                 print(
                     f"Reader has timed out. Timeout was {self.serial.timeout}")
                 continue
-            self.cmd_buffer.append(byte)
-            cmd = self.cmd_buffer.parse_command()
-            if cmd:
-                # TODO Handle all cmds
-                # TODO Update cmd freqs and keep cmd receive times
-                # TODO Update screen
-                logging.debug(
-                    f"Queueing command {cmd} received at {time.time() - self.start_time}")
-                cmd_type = type(cmd)
-                if cmd_type == DistanceCommand:
-                    logging.info(f"Distance report: {cmd.distance}")
-                    self.screen.set_distance(cmd.distance)
-                elif cmd_type == AltitudeCommand:
-                    logging.info(f"Altitude report: {cmd.altitude}")
-                    self.screen.set_altitude(cmd.altitude)
-                else:
-                    # TODO
-                    # logging.warning(
-                    #     f"Command handler is not implemented: {cmd}")
-                    pass
-                self.cmd_queue.put(cmd)
+            self.receive(data)
+
+    def receive(self, data: bytes):
+        if self.recorder:
+            self.recorder.record(FROM_PLANE, data)
+        # All frames of one read are stamped with the time the read returned
+        timestamp = self.cmd_queue.get_current_relative_timestamp()
+        for cmd in self.cmd_buffer.feed(data):
+            # TODO Update cmd freqs and keep cmd receive times
+            logging.debug(
+                f"Queueing command {cmd} received at {timestamp}")
+            cmd_type = type(cmd)
+            if cmd_type == StatsCommand:
+                # Answers to query_stats() are not periodic frames, keep them from the agents
+                self.plane_stats[cmd.counter] = cmd.value
+                continue
+            if cmd_type == TraceCommand:
+                entries = self.trace_decoder.feed(cmd)
+                if entries is not None:
+                    self.write_trace(entries)
+                continue
+            if cmd_type == DistanceCommand:
+                logging.info(f"Distance report: {cmd.distance}")
+                self.screen.set_distance(cmd.distance)
+            elif cmd_type == AltitudeCommand:
+                logging.info(f"Altitude report: {cmd.altitude}")
+                self.screen.set_altitude(cmd.altitude)
+            self.cmd_queue.put(cmd, timestamp)
 
     def stop_reader(self):
         """
@@ -132,16 +232,77 @@ class AutoPilot:
         logging.debug(f"AutoPilot reader thread will be joined")
         self.reader_thread.join(0.1)
 
+    def encode(self, cmd: Command) -> bytes:
+        return cmd.make_binary() if self.binary_frames else cmd.make_bytes()
+
     def write(self, message: bytes | Command):
+        """
+        Writes right away, used for GO and the queries of the autopilot itself
+        """
         logging.debug(f"Writing '{str(message)}'")
         with self.writer_lock:
             if issubclass(type(message), Command):
-                self.serial.write(message.make_bytes())
-            elif type(message) == bytes:
-                self.serial.write(message)
-            else:
+                message = self.encode(message)
+            elif type(message) != bytes:
                 logging.error(
                     f"Write has received message of unknown type {type(message)}")
+                return
+            self.serial.write(message)
+            if self.recorder:
+                self.recorder.record(TO_PLANE, message)
+
+    def submit(self, cmd: Command):
+        """
+        Sends a command of an agent, in the next batch of the writer if there is one
+        """
+        if self.writer:
+            self.writer.submit(cmd)
+        else:
+            self.write(cmd)
+
+    def negotiate_binary_frames(self):
+        """
+        Switches both directions to binary frames. The handshake itself is sent in
+        ASCII; the plane answers in binary from its next frame on, which the reader
+        accepts in either format.
+        """
+        logging.info(f"Switching to binary frames")
+        self.write(BinaryModeCommand(1))
+        self.binary_frames = True
+
+    def query_stats(self):
+        """
+        Asks for the plane's counters every stats_interval seconds, half a period
+        after a telemetry frame so that the answers do not delay the next one
+        """
+        if not self.alive:
+            return
+        self.write(StatsQueryCommand())
+        self.stats_alarm = AlarmAgent.instance().add_alarm(
+            self.query_stats, get_clock().now() + self.stats_interval)
+
+    def log_stats(self):
+        if not self.plane_stats:
+            return
+        names = {c.value: c.name.lower() for c in StatsCounter}
+        table = "\n".join(f"{names.get(c, str(c)):<20} {v:>6}" for c, v in sorted(self.plane_stats.items()))
+        logging.info(f"Plane counters:\n{table}")
+
+    def query_trace(self):
+        """
+        Asks the plane to dump its flight recorder
+        """
+        if not self.alive:
+            return
+        logging.info(f"Requesting the plane's flight recorder")
+        self.write(TraceQueryCommand())
+
+    def write_trace(self, entries: list[TraceEntry]):
+        timeline = format_timeline(entries)
+        logging.info(f"Flight recorder dump {self.trace_decoder.dumps}, {len(entries)} entries:\n{timeline}")
+        if self.trace_report:
+            with open(f"{self.trace_report}-{self.trace_decoder.dumps}.txt", "w") as f:
+                f.write(timeline + "\n")
 
     def update_screen(self, update: object):
         self.screen.update(update)
@@ -158,6 +319,11 @@ class AutoPilot:
                     self.mode_cv.notify()
 
     def wait_until_start(self):
+        if self.headless:
+            with self.mode_cv:
+                self.mode = SimulatorMode.ACTIVE
+            logging.info(f"Simulator is now in ACTIVE mode.")
+            return
         # Wait until user presses "s" in the screen
         with self.mode_cv:
             self.mode_cv.wait_for(lambda: self.mode == SimulatorMode.ACTIVE)
@@ -169,7 +335,7 @@ class AutoPilot:
         total_distance = 10000
         period = CMD_PERIOD    # secs
         logging.info(f"Demo sends GoCommand")
-        self.start_time = time.time()
+        self.start_time = get_clock().now()
         self.cmd_queue.set_start_time(self.start_time)
         self.write(GoCommand(total_distance))
         self.write(AltitudeCommand(AltitudePeriod.ALT_400))
@@ -206,27 +372,55 @@ class AutoPilot:
         return periodicity_agent
 
     def agents_demo(self):
+        self.start_flight()
+        # With a virtual clock this runs the whole flight, returning when it finishes
+        get_clock().sleep(flight_timeout(self.compiled))
+
+    def start_flight(self):
+        """
+        Sends GO and sets up the agents of the test case, which fly the rest
+        """
         self.wait_until_start()
+        testcase = self.testcase
         logging.info(f"Agents Demo sends GoCommand")
         # FIXME Too many time vars, reduce them
-        self.start_time = time.time()
+        self.start_time = get_clock().now()
         self.cmd_queue.set_start_time(self.start_time)
-        TESTCASE["go-time"] = self.start_time
-        self.update_screen({"TESTCASE": TESTCASE})
-        self.cmd_queue.set_start_time(TESTCASE["go-time"])
-        self.write(GoCommand(TESTCASE["total-distance"]))
+        testcase["go-time"] = self.start_time
+        self.update_screen({"TESTCASE": testcase})
+        self.cmd_queue.set_start_time(testcase["go-time"])
+        if self.cadence_report:
+            self.cadence = CadenceAnalyzer(testcase["period"], testcase["period-offset"])
+            self.cmd_queue.set_analyzer(self.cadence)
+        if self.record:
+            # Everything the replay needs to fly the same test case the same way
+            metadata = {"testcase": {k: v for k, v in testcase.items() if k != "go-time"},
+                        "binary_frames": self.binary_frames_wanted, "baudrate": self.baudrate,
+                        "write_offset": self.write_offset, "clock": "virtual" if self.virtual else "real"}
+            self.recorder = SessionRecorder(self.record, metadata, get_clock())
+        if self.binary_frames_wanted:
+            self.negotiate_binary_frames()
+        self.write(GoCommand(testcase["total-distance"]))
+        if isinstance(self.serial, VirtualPlane):
+            self.serial.fly(self.compiled, self.start_time)
+        if self.stats_interval:
+            self.stats_alarm = AlarmAgent.instance().add_alarm(
+                self.query_stats, self.start_time + self.stats_interval + testcase["period"] / 2)
+        self.trace_alarms = [AlarmAgent.instance().add_alarm(self.query_trace, self.start_time + t)
+                             for t in self.trace_at]
         # Create and setup agents
-        cmd_dispatcher = CommandDispatcherAgent(self.cmd_queue, TESTCASE, self)
+        if self.write_offset is not None:
+            self.writer = WriterAgent(self.write_offset, testcase, self)
+        cmd_dispatcher = CommandDispatcherAgent(self.cmd_queue, testcase, self)
         periodicity_agent: PeriodicityAgent = self.setup_periodicity_agent(
-            TESTCASE)
-        manual_agent = ManualAgent(periodicity_agent, TESTCASE, self)
+            testcase)
+        manual_agent = ManualAgent(periodicity_agent, testcase, self)
         # Register command consuming agents to the command dispatcher
         cmd_dispatcher.add_agent(periodicity_agent)
         cmd_dispatcher.start()
         # Assign to self
         self.cmd_dispatcher = cmd_dispatcher
         self.periodicity_agent = periodicity_agent
-        time.sleep(100)
 
     def finish(self):
         if self.periodicity_agent:
@@ -235,23 +429,185 @@ class AutoPilot:
         if self.cmd_dispatcher:
             self.cmd_dispatcher.finish()
             self.periodicity_agent = None
+        if self.writer:
+            self.writer.finish()
+        if self.recorder:
+            self.recorder.close()
         self.stop_reader()
+        if self.stats_alarm:
+            AlarmAgent.instance().cancel_alarm(self.stats_alarm)
+            self.stats_alarm = None
+        for alarm in self.trace_alarms:
+            AlarmAgent.instance().cancel_alarm(alarm)
+        self.trace_alarms = []
+        self.log_stats()
+        if self.cadence:
+            self.cmd_queue.set_analyzer(None)
+        if self.on_finish:
+            self.on_finish(self)
+            return
+        get_clock().stop()
         # Finishing a singleton does not make sense unless the program is exiting
         # AlarmAgent.instance().finish()
+        AlarmAgent.instance().report()
+        if self.cadence:
+            self.cadence.write(self.cadence_report)
+            self.cadence = None
         if not AlarmAgent.instance().is_empty():
             logger.warning(
                 f"AutoPilot has finished but AlarmAgent is not empty. Some alarms may be delivered later.")
 
 
+class Fleet:
+    """
+    Flies several planes side by side on the virtual clock. Each one is an
+    AutoPilot with its own VirtualPlane, i.e. its own board of the firmware
+    library, and its own copy of the test case; their alarms share AlarmAgent.
+    The clock is stopped once every plane has finished, and the cadence of all
+    planes goes into one report.
+    """
+
+    def __init__(self, size: int, cadence_report=None, stats_interval=0, trace_at=(), trace_report=None,
+                 write_offset=None, record=None):
+        self.cadence_report = cadence_report
+        self.flying = size
+        self.pilots = [AutoPilot(PORT, BAUDRATE, 'N', rtscts=False, xonxoff=False, headless=True,
+                                 cadence_report=cadence_report, stats_interval=stats_interval,
+                                 testcase=copy.deepcopy(TESTCASE), compiled=COMPILED,
+                                 on_finish=self.on_finish, trace_at=trace_at,
+                                 trace_report=f"{trace_report}-plane{i}" if trace_report else None,
+                                 write_offset=write_offset,
+                                 record=f"{record}-plane{i}" if record else None)
+                       for i in range(size)]
+
+    def on_finish(self, pilot: AutoPilot):
+        self.flying -= 1
+        if self.flying == 0:
+            get_clock().stop()
+
+    def fly(self):
+        logging.info(f"Fleet of {len(self.pilots)} planes takes off")
+        for pilot in self.pilots:
+            pilot.start_flight()
+        get_clock().sleep(flight_timeout(COMPILED))
+        for pilot in self.pilots:
+            if pilot.alive:
+                # The flight did not reach distance 0 in time
+                pilot.finish()
+        AlarmAgent.instance().report()
+        if self.cadence_report:
+            write_fleet_report(self.cadence_report, [p.cadence for p in self.pilots])
+
+
+def replay(path: str, speed: float, cadence_report=None):
+    """
+    Flies the agents against a recorded session instead of a plane. The frames
+    the plane sent reach them at their recorded times after GO, on a virtual
+    clock running speed times as fast as real time, or as fast as possible with
+    0. Logs how fast they were validated and whether the agents wrote the same
+    bytes as in the recording.
+    """
+    session = load_session(path)
+    metadata = session.metadata
+    logging.info(f"Replaying {path}: {session.summary()}")
+    set_clock(VirtualClock(speed=speed))
+    testcase = metadata["testcase"]
+    port = ReplayPort(get_clock(), session)
+    ap = AutoPilot(PORT, metadata["baudrate"], 'N', rtscts=False, xonxoff=False, headless=True,
+                   cadence_report=cadence_report, testcase=testcase, compiled=compile_testcase(testcase),
+                   write_offset=metadata["write_offset"], port_stand_in=port,
+                   binary_frames=metadata["binary_frames"])
+    port.receiver = ap.receive
+    started = time.monotonic()
+    ap.start_flight()
+    port.start(ap.start_time)
+    get_clock().sleep(flight_timeout(ap.compiled))
+    if ap.alive:
+        ap.finish()
+    elapsed = max(time.monotonic() - started, 1e-9)
+    logging.info(f"Replayed {port.delivered} bytes of {session.duration:.3f} s in {elapsed:.3f} s: " +
+                 f"{port.delivered / elapsed:.0f} bytes/s, {session.duration / elapsed:.1f}x real time")
+    divergence = port.divergence()
+    if divergence is None:
+        logging.info(f"The agents wrote the {len(port.written)} recorded bytes")
+    else:
+        logging.warning(f"The agents' writes differ from the recording from byte {divergence} on " +
+                        f"({len(port.written)} written, {len(port.expected)} recorded)")
+
+
 def main():
-    ap = AutoPilot(PORT, BAUDRATE, 'N',
-                   rtscts=False, xonxoff=False)
+    global TESTCASE, COMPILED
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--test-case", help="test case to fly instead of test-case-0.json")
+    parser.add_argument("--port", default=PORT,
+                        help="serial device of the plane, e.g. the pty of host/build/plane")
+    parser.add_argument("--headless", action="store_true", default=HEADLESS,
+                        help="run without the window, starting the flight right away")
+    parser.add_argument("--clock", choices=["real", "virtual"], default=CLOCK,
+                        help="virtual flies the firmware's host build faster than real time")
+    parser.add_argument("--cadence-report", default=CADENCE_REPORT, metavar="PREFIX",
+                        help="write frame arrival timing to PREFIX.csv and PREFIX.json")
+    parser.add_argument("--stats-interval", type=float, default=STATS_INTERVAL, metavar="SECONDS",
+                        help="query the plane's buffer and UART counters with $STA# this often")
+    parser.add_argument("--trace-at", type=float, action="append", default=None, metavar="SECONDS",
+                        help="dump the plane's flight recorder this long after GO, may be repeated")
+    parser.add_argument("--trace-report", default=TRACE_REPORT, metavar="PREFIX",
+                        help="write the flight recorder timelines to PREFIX-<n>.txt")
+    parser.add_argument("--write-offset", type=float, default=WRITE_OFFSET, metavar="SECONDS",
+                        help="write the commands of each period in one batch this long after its boundary, " +
+                             "a negative value writes every command right away")
+    parser.add_argument("--record", default=RECORD, metavar="PREFIX",
+                        help="record every byte to and from the plane to PREFIX.session")
+    parser.add_argument("--replay", metavar="LOG",
+                        help="fly the agents against a session recording instead of a plane")
+    parser.add_argument("--replay-speed", type=float, default=0, metavar="N",
+                        help="replay N times as fast as recorded, 0 (default) as fast as possible")
+    parser.add_argument("--fleet", type=int, default=1, metavar="N",
+                        help="fly N virtual planes side by side (needs --clock virtual)")
+    args = parser.parse_args()
+    trace_at = TRACE_AT if args.trace_at is None else args.trace_at
+    write_offset = args.write_offset if args.write_offset is not None and args.write_offset >= 0 else None
+    if args.fleet > 1 and args.clock != "virtual":
+        parser.error("--fleet needs --clock virtual")
+    if args.test_case:
+        COMPILED = load_compiled(args.test_case)
+        TESTCASE = COMPILED.config
+    if args.replay:
+        replay(args.replay, args.replay_speed, cadence_report=args.cadence_report)
+        return
+    print(TESTCASE)
+    if args.clock == "virtual":
+        set_clock(VirtualClock())
+    if args.fleet > 1:
+        Fleet(args.fleet, cadence_report=args.cadence_report, stats_interval=args.stats_interval,
+              trace_at=trace_at, trace_report=args.trace_report, write_offset=write_offset,
+              record=args.record).fly()
+        finish_run()
+
+    ap = AutoPilot(args.port, BAUDRATE, 'N',
+                   rtscts=False, xonxoff=False, headless=args.headless,
+                   cadence_report=args.cadence_report, stats_interval=args.stats_interval,
+                   trace_at=trace_at, trace_report=args.trace_report, write_offset=write_offset,
+                   record=args.record)
     # dw = DistanceWriter(ap, 1)
     ap.agents_demo()
+    if ap.headless:
+        if ap.alive:
+            # The flight did not reach distance 0 in time
+            ap.finish()
+        finish_run()
     while True:
         pass
 
 
+def finish_run():
+    """
+    Ends a run that has no window to keep open, with status 1 if it logged errors
+    """
+    logging.info(f"Run finished with {ERRORS.count} errors")
+    sys.exit(1 if ERRORS.count else 0)
+
+
 if __name__ == "__main__":
     # PORT = input("Dev name: ")
     main()
@@ -0,0 +1,182 @@
+"""
+Frame cadence report. With --cadence-report PREFIX, AutoPilot hands every frame
+the plane sends to a CadenceAnalyzer, which puts it in the period it arrived in.
+At the end of the flight the frames are written to <prefix>.csv with their
+offset from the period boundary. <prefix>.json gets the per frame type summary:
+offset and inter-arrival percentiles, out of window frames, duplicate periods
+and skipped periods. A fleet writes one report with a row per plane
+(write_fleet_report).
+"""
+import csv
+import json
+import logging
+
+from cmds import Command
+from histogram import Histogram
+
+logger = logging.getLogger("cadence")
+
+# Histogram resolution and range, seconds
+BUCKET_WIDTH = 0.0001
+BUCKET_COUNT = 5000
+
+
+class FrameTypeStats:
+    """
+    Arrival timing of one frame type
+    """
+
+    def __init__(self):
+        self.frames = 0
+        self.offset = Histogram(BUCKET_WIDTH, BUCKET_COUNT)          # |arrival - period boundary|
+        self.interarrival = Histogram(BUCKET_WIDTH, BUCKET_COUNT)    # to the previous frame of the type
+        self.out_of_window = 0
+        self.duplicates = 0
+        self.last_timestamp = None
+
+    def summary(self) -> dict:
+        def ms(value):
+            return None if value is None else round(value * 1000, 3)
+        return {
+            "frames": self.frames,
+            "offset-p50-ms": ms(self.offset.percentile(50)),
+            "offset-p99-ms": ms(self.offset.percentile(99)),
+            "offset-max-ms": ms(self.offset.max),
+            "interarrival-p50-ms": ms(self.interarrival.percentile(50)),
+            "interarrival-p99-ms": ms(self.interarrival.percentile(99)),
+            "interarrival-max-ms": ms(self.interarrival.max),
+            "out-of-window": self.out_of_window,
+            "duplicates": self.duplicates,
+        }
+
+
+class CadenceAnalyzer:
+    """
+    Classifies every frame received from the plane by the period it arrived in.
+    Each period should carry exactly one frame (DST, ALT or PRS) close to its
+    boundary. Periods without a frame are skipped, a second frame in a period is
+    a duplicate and a frame farther than period-offset from the boundary is out
+    of window.
+
+    Timestamps are relative to GO, as CommandQueue gives them.
+    """
+
+    def __init__(self, period: float, period_offset: float):
+        self.period = period
+        self.period_offset = period_offset
+        self.stats: dict[str, FrameTypeStats] = {}
+        self.rows = []                  # one per frame, for the CSV
+        self.seen_periods = set()
+        self.first_period = None
+        self.last_period = None
+
+    def record(self, timestamp: float, cmd: Command):
+        if not cmd.MSG_ID:
+            return  # CommandDispatcherAgent's wake-up, not a frame
+        period_no = round(timestamp / self.period)
+        offset = timestamp - period_no * self.period
+        frame_type = cmd.MSG_ID.decode()
+        stats = self.stats.get(frame_type)
+        if stats is None:
+            stats = self.stats[frame_type] = FrameTypeStats()
+
+        stats.frames += 1
+        stats.offset.add(abs(offset))
+        if stats.last_timestamp is not None:
+            stats.interarrival.add(timestamp - stats.last_timestamp)
+        stats.last_timestamp = timestamp
+        out_of_window = abs(offset) >= self.period_offset
+        if out_of_window:
+            stats.out_of_window += 1
+        duplicate = period_no in self.seen_periods
+        if duplicate:
+            stats.duplicates += 1
+        self.seen_periods.add(period_no)
+        if self.first_period is None:
+            self.first_period = period_no
+        self.last_period = period_no
+
+        self.rows.append((round(timestamp, 6), period_no, round(offset * 1000, 3), frame_type,
+                          str(cmd), int(out_of_window), int(duplicate)))
+
+    def skipped_periods(self) -> list[int]:
+        if self.first_period is None:
+            return []
+        return [p for p in range(self.first_period, self.last_period + 1)
+                if p not in self.seen_periods]
+
+    def summary(self) -> dict:
+        skipped = self.skipped_periods()
+        return {
+            "period-ms": self.period * 1000,
+            "period-offset-ms": self.period_offset * 1000,
+            "first-period": self.first_period,
+            "last-period": self.last_period,
+            "skipped-periods": len(skipped),
+            "skipped": skipped,
+            "types": {t: s.summary() for t, s in sorted(self.stats.items())},
+        }
+
+    def write(self, prefix: str):
+        """
+        Writes <prefix>.csv with every frame and <prefix>.json with the summary,
+        and logs the summary table.
+        """
+        with open(f"{prefix}.csv", "w", newline="") as f:
+            writer = csv.writer(f)
+            writer.writerow(["timestamp", "period", "offset-ms", "type", "frame",
+                             "out-of-window", "duplicate"])
+            writer.writerows(self.rows)
+        summary = self.summary()
+        with open(f"{prefix}.json", "w") as f:
+            json.dump(summary, f, indent=2)
+        logger.info(f"Cadence report written to {prefix}.csv and {prefix}.json\n" + self.table(summary))
+
+    def table(self, summary: dict = None) -> str:
+        summary = summary or self.summary()
+        lines = [f"{'type':<5} {'frames':>7} {'off p50':>8} {'off p99':>8} {'off max':>8} " +
+                 f"{'gap p50':>8} {'gap p99':>8} {'gap max':>8} {'window':>7} {'dup':>5}"]
+
+        def cell(value):
+            return f"{'-':>8}" if value is None else f"{value:>8.2f}"
+        for t, s in summary["types"].items():
+            lines.append(f"{t:<5} {s['frames']:>7} {cell(s['offset-p50-ms'])} {cell(s['offset-p99-ms'])} " +
+                         f"{cell(s['offset-max-ms'])} {cell(s['interarrival-p50-ms'])} " +
+                         f"{cell(s['interarrival-p99-ms'])} {cell(s['interarrival-max-ms'])} " +
+                         f"{s['out-of-window']:>7} {s['duplicates']:>5}")
+        lines.append(f"periods {summary['first-period']}-{summary['last-period']}, " +
+                     f"{summary['skipped-periods']} skipped (times in ms)")
+        return "\n".join(lines)
+
+
+def write_fleet_report(prefix: str, analyzers: list[CadenceAnalyzer]):
+    """
+    Writes the frames of every plane of a fleet to <prefix>.csv, with the plane
+    number in the first column, and one summary per plane to <prefix>.json, and
+    logs a line per plane. Planes without an analyzer are left out.
+    """
+    planes = [(no, a) for no, a in enumerate(analyzers) if a is not None]
+    with open(f"{prefix}.csv", "w", newline="") as f:
+        writer = csv.writer(f)
+        writer.writerow(["plane", "timestamp", "period", "offset-ms", "type", "frame",
+                         "out-of-window", "duplicate"])
+        for no, a in planes:
+            writer.writerows((no,) + row for row in a.rows)
+    summaries = {no: a.summary() for no, a in planes}
+    with open(f"{prefix}.json", "w") as f:
+        json.dump({"planes": summaries}, f, indent=2)
+
+    lines = [f"{'plane':>5} {'frames':>7} {'periods':>8} {'skipped':>8} {'window':>7} {'dup':>5}"]
+    totals = [0, 0, 0, 0, 0]
+    for no, summary in summaries.items():
+        types = summary["types"].values()
+        first, last = summary["first-period"], summary["last-period"]
+        row = [sum(t["frames"] for t in types),
+               0 if first is None else last - first + 1,
+               summary["skipped-periods"],
+               sum(t["out-of-window"] for t in types),
+               sum(t["duplicates"] for t in types)]
+        totals = [t + r for t, r in zip(totals, row)]
+        lines.append(f"{no:>5} {row[0]:>7} {row[1]:>8} {row[2]:>8} {row[3]:>7} {row[4]:>5}")
+    lines.append(f"{'all':>5} {totals[0]:>7} {totals[1]:>8} {totals[2]:>8} {totals[3]:>7} {totals[4]:>5}")
+    logger.info(f"Fleet cadence report written to {prefix}.csv and {prefix}.json\n" + "\n".join(lines))
@@ -0,0 +1,135 @@
+import heapq
+import logging
+import time
+from itertools import count
+
+logger = logging.getLogger("clock")
+
+
+class RealClock:
+    """
+    Real time, used when the simulator talks to a board. It is monotonic, so
+    wall clock adjustments cannot move alarms or command timestamps.
+    """
+    virtual = False
+
+    def now(self) -> float:
+        return time.monotonic()
+
+    def sleep(self, seconds: float):
+        time.sleep(seconds)
+
+    def stop(self):
+        pass
+
+
+class VirtualClock:
+    """
+    Discrete-event clock. Time only moves when sleep() runs the simulation: it
+    jumps straight to the earliest pending event, runs it and repeats.
+
+    Events come from call_at() and from the registered sources. A source has
+    next_event_time() (None if it has nothing pending) and run_due(), which runs
+    everything due at now(). Idle hooks run after every event, which is where
+    work that is triggered by an event (e.g. dispatching received commands) is done.
+
+    With a speed, sleep() also waits in real time before each event, so that
+    virtual time passes speed times as fast as real time (e.g. for a replay at
+    1x). 0 runs the events back to back.
+    """
+    virtual = True
+
+    def __init__(self, start_time: float = 0.0, speed: float = 0):
+        self._now = start_time
+        self.speed = speed
+        self._pace_origin = None    # (virtual, real) time the pacing counts from
+        self._events = []
+        self._sources = []
+        self._idle_hooks = []
+        self._stopped = False
+        self._unique = count()
+
+    def now(self) -> float:
+        return self._now
+
+    def call_at(self, timestamp: float, callback, *args):
+        heapq.heappush(self._events, (timestamp, next(self._unique), callback, args))
+
+    def add_source(self, source):
+        self._sources.append(source)
+
+    def add_idle_hook(self, hook):
+        self._idle_hooks.append(hook)
+
+    def stop(self):
+        """
+        Makes the running sleep() return after the current event.
+        """
+        self._stopped = True
+
+    def sleep(self, seconds: float):
+        """
+        Runs the events of the next given seconds. Returns early if stop() is
+        called or nothing is left to run.
+        """
+        deadline = self._now + seconds
+        self._stopped = False
+        if self.speed:
+            self._pace_origin = (self._now, time.monotonic())
+        while not self._stopped:
+            self._run_idle_hooks()
+            timestamp, source = self._next_event()
+            if timestamp is None or timestamp > deadline:
+                self._now = deadline
+                return
+            if self.speed:
+                self._pace(timestamp)
+            self._now = max(self._now, timestamp)
+            if source is None:
+                _, _, callback, args = heapq.heappop(self._events)
+                callback(*args)
+            else:
+                source.run_due()
+        logger.debug(f"VirtualClock stopped at {self._now}")
+
+    def _pace(self, timestamp: float):
+        virtual_origin, real_origin = self._pace_origin
+        delay = real_origin + (timestamp - virtual_origin) / self.speed - time.monotonic()
+        if delay > 0:
+            time.sleep(delay)
+
+    def _next_event(self):
+        timestamp, source = None, None
+        if self._events:
+            timestamp = self._events[0][0]
+        for s in self._sources:
+            t = s.next_event_time()
+            if t is not None and (timestamp is None or t < timestamp):
+                timestamp, source = t, s
+        return timestamp, source
+
+    def _run_idle_hooks(self):
+        for hook in self._idle_hooks:
+            hook()
+
+
+_clock = RealClock()
+
+
+def get_clock():
+    """
+    Returns the clock shared by all agents
+    """
+    return _clock
+
+
+def set_clock(clock):
+    """
+    Replaces the shared clock. Must be called before any agent is created.
+    """
+    global _clock
+    _clock = clock
+
+
+def now() -> float:
+    return _clock.now()
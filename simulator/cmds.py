@@ -1,6 +1,7 @@
 import logging
 from enum import Enum, IntEnum
-from utils import int2hexstring, hexstring2int
+from protocol import ASCII_SPECS, BINARY_OVERHEAD, BINARY_SPECS, BINARY_SYNC, MESSAGES, BinaryType, MessageSpec
+from utils import int2hexstring, hexstring2int, crc8
 
 
 CMD_START_BYTE = b'$'
@@ -8,6 +9,10 @@ CMD_END_BYTE = b'#'
 CMD_START_INT = int.from_bytes(CMD_START_BYTE, byteorder="little")
 CMD_END_INT = int.from_bytes(CMD_END_BYTE, byteorder="little")
 
+# Binary frames: sync, type, little-endian payload, CRC-8 of type and payload
+BINARY_SYNC_BYTE = bytes([BINARY_SYNC])
+BINARY_SYNC_INT = BINARY_SYNC
+
 
 class AltitudePeriod(IntEnum):
     """
@@ -43,66 +48,127 @@ class LedValue(IntEnum):
     LED_4 = 4
     LED_MAX = LED_4
 
-class CommandID:
-    # Plane CMD IDs
-    SPEED_MSG_ID = b"SPD"
-    DISTANCE_MSG_ID = b"DST"
-    ALTITUDE_MSG_ID = b"ALT"
-    PRESS_MSG_ID = b"PRS"
-    # AutoPilot CMD IDs
-    LED_MSG_ID = b"LED"
-    FUEL_MSG_ID = b"FUE"
-    TURBULENCE_MSG_ID = b"TUR"  # MAX ALTITUDE and MAX SPEED
-    ALTITUDE_FREQ_MSG_ID = b"FRE"
-    GO_MSG_ID = b"GOO"  # total distance
-    END_MSG_ID = b"END"
-    MANUAL_MSG_ID = b"MAN"
+class StatsCounter(IntEnum):
+    """
+    Counters the plane reports in answer to $STA#, in the order of its StatsCounter
+    """
+    RX_DROPS = 0
+    """
+    Bytes the plane lost because its input buffer was full
+    """
+    TX_DROPS = 1
+    """
+    Frames the plane did not send because its output buffer was full
+    """
+    RX_HIGH_WATER = 2
+    """
+    Highest input buffer occupancy in bytes
+    """
+    TX_HIGH_WATER = 3
+    """
+    Highest output buffer occupancy in bytes
+    """
+    UART_OVERRUNS = 4
+    """
+    Bytes lost in the plane's receiver before they could be buffered
+    """
+    UART_FRAMING_ERRORS = 5
+    """
+    Bytes received without a valid stop bit
+    """
+    CPU_LOAD = 6
+    """
+    Permille of the last second the plane's CPU was awake
+    """
 
 
 class Command:
-    MSG_ID = None
+    """
+    A message of the protocol. Subclasses name their MessageSpec (protocol.py,
+    generated from protocol/messages.json) in SPEC and keep its fields as
+    attributes, in the order of their constructor's arguments. The ASCII and
+    binary codecs are driven by the spec, and parsing dispatches on dicts keyed
+    by the message ID and digit count or by the binary type.
+    """
+    SPEC: MessageSpec = None
+    MSG_ID = None       # 3-character ID, from SPEC
+    BINARY_TYPE = None  # type byte used when the command is sent in a binary frame
+    PAYLOAD_SIZE = 0    # payload bytes of the binary frame
+
+    def __init_subclass__(cls, **kwargs):
+        super().__init_subclass__(**kwargs)
+        if cls.SPEC is not None:
+            cls.MSG_ID = cls.SPEC.msg_id
+            cls.BINARY_TYPE = cls.SPEC.binary_type
+            cls.PAYLOAD_SIZE = cls.SPEC.payload_size
+
+    @property
+    def packed(self) -> int:
+        """
+        The fields as one number, the first one in the most significant digits
+        """
+        value = 0
+        for name, digits in self.SPEC.fields:
+            value = (value << (4 * digits)) | int(getattr(self, name))
+        return value
+
+    @classmethod
+    def from_value(cls, value: int, spec: MessageSpec = None):
+        """
+        Makes the command whose packed fields are value
+        """
+        spec = spec or cls.SPEC
+        shift = 4 * spec.digits
+        args = []
+        for _, digits in spec.fields:
+            shift -= 4 * digits
+            args.append((value >> shift) & ((1 << (4 * digits)) - 1))
+        return cls(*args)
 
     def make_bytes(self):
-        raise Exception("Not implemented")
+        body = b"".join(int2hexstring(int(getattr(self, name)), digits) for name, digits in self.SPEC.fields)
+        return CMD_START_BYTE + self.MSG_ID + body + CMD_END_BYTE
+
+    def make_binary(self):
+        """
+        Returns the command as a binary frame.
+        """
+        body = bytes([self.BINARY_TYPE]) + self.packed.to_bytes(self.PAYLOAD_SIZE, byteorder="little")
+        return BINARY_SYNC_BYTE + body + bytes([crc8(body)])
+
+    @classmethod
+    def parse_binary(cls, buffer: bytes):
+        if len(buffer) < BINARY_OVERHEAD or buffer[0] != BINARY_SYNC_INT:
+            logging.error("Unable to parse binary buffer!")
+            return None
+        spec = BINARY_SPECS.get(buffer[1])
+        if spec is None or len(buffer) != spec.payload_size + BINARY_OVERHEAD:
+            logging.error(f"Binary frame of unknown type {buffer[1]:#04x}!")
+            return None
+        if crc8(buffer[1:-1]) != buffer[-1]:
+            logging.error("Binary frame CRC mismatch!")
+            return None
+        return COMMAND_CLASSES[spec.class_name].from_value(int.from_bytes(buffer[2:-1], byteorder="little"), spec)
 
     @classmethod
     def parse_bytes(cls, buffer: bytes):
         if buffer[0] != CMD_START_INT or buffer[-1] != CMD_END_INT:
             logging.error("Unable to parse buffer!")
             return None
-        if cls.MSG_ID != None and buffer[1:4] != cls.MSG_ID:
+        msg_id = bytes(buffer[1:4])
+        if cls.MSG_ID != None and msg_id != cls.MSG_ID:
             logging.error("Wrong message id!")
             return None
-        return cls._parse_bytes(buffer)
-
-    @classmethod
-    def _parse_bytes(cls, buffer: bytes):
-        """
-        To be overriden by subclass.
-        This default one figures out the subclass by looking at msg id bytes.
-        """
-        cmd_id = buffer[1:4]
-        if cmd_id == CommandID.SPEED_MSG_ID:
-            return SpeedCommand._parse_bytes(buffer)
-        elif cmd_id == CommandID.DISTANCE_MSG_ID:
-            return DistanceCommand._parse_bytes(buffer)
-        elif cmd_id == CommandID.ALTITUDE_MSG_ID:
-            return AltitudeCommand._parse_bytes(buffer)
-        elif cmd_id == CommandID.GO_MSG_ID:
-            return GoCommand._parse_bytes(buffer)
-        elif cmd_id == CommandID.LED_MSG_ID:
-            return LedCommand._parse_bytes(buffer)
-        elif cmd_id == CommandID.MANUAL_MSG_ID:
-            return ManualCommand._parse_bytes(buffer)
-        elif cmd_id == CommandID.PRESS_MSG_ID:
-            return PressCommand._parse_bytes(buffer)
-        elif cmd_id == CommandID.END_MSG_ID:
-            return EndCommand._parse_bytes(buffer)
-        else:
-            # TODO Implement the rest of them
-            logging.error(
-                f"Command type for MSG ID {cmd_id} is not found! (Not implemented yet?)")
+        spec = ASCII_SPECS.get((msg_id, len(buffer) - 5))
+        if spec is None:
+            logging.error(f"Command type for MSG ID {msg_id} with {len(buffer) - 5} digits is not found!")
             return None
+        args = []
+        pos = 4
+        for _, digits in spec.fields:
+            args.append(hexstring2int(buffer[pos:pos + digits]))
+            pos += digits
+        return COMMAND_CLASSES[spec.class_name](*args)
 
     def __repr__(self):
         cls_name = type(self).__name__
@@ -113,26 +179,22 @@ class Command:
         return repr
 
 
+def spec(msg_id: bytes, direction: str) -> MessageSpec:
+    return next(s for s in MESSAGES if s.msg_id == msg_id and s.direction == direction)
+
+
 # ---------------- Plane CMDs
 class SpeedCommand(Command):
-    MSG_ID = CommandID.SPEED_MSG_ID
+    SPEC = spec(b"SPD", "in")
 
     speed: int
 
     def __init__(self, speed: int):
         self.speed = speed
 
-    @classmethod
-    def _parse_bytes(cls, buffer: bytes):
-        speed = hexstring2int(buffer[4:8])
-        return SpeedCommand(speed)
-
-    def make_bytes(self):
-        return CMD_START_BYTE + SpeedCommand.MSG_ID + int2hexstring(self.speed) + CMD_END_BYTE
-
 
 class PressCommand(Command):
-    MSG_ID = CommandID.PRESS_MSG_ID
+    SPEC = spec(b"PRS", "out")
 
     button: int
 
@@ -141,115 +203,122 @@ class PressCommand(Command):
         if type(self.button) != int or self.button > 7 or self.button < 4:
             logging.error(f"Invalid PressCommand button value: {self.button}")
 
-    @classmethod
-    def _parse_bytes(cls, buffer: bytes):
-        # FIXME Ask Merve
-        button = hexstring2int(buffer[4:6])
-        return PressCommand(button)
-
-    def make_bytes(self):
-        return CMD_START_BYTE + PressCommand.MSG_ID + int2hexstring(self.button, 2) + CMD_END_BYTE
-
 
 class DistanceCommand(Command):
-    MSG_ID = CommandID.DISTANCE_MSG_ID
+    SPEC = spec(b"DST", "out")
 
     distance: int
 
     def __init__(self, distance: int):
         self.distance = distance
 
-    def make_bytes(self):
-        return CMD_START_BYTE + CommandID.DISTANCE_MSG_ID + int2hexstring(self.distance) + CMD_END_BYTE
 
-    @classmethod
-    def _parse_bytes(cls, buffer: bytes):
-        distance = hexstring2int(buffer[4:8])
-        return DistanceCommand(distance)
+class StatsCommand(Command):
+    """
+    One buffer or UART counter of the plane, $STA + 2-digit counter + 4-digit value
+    """
+    SPEC = spec(b"STA", "out")
+
+    counter: int
+    value: int
+
+    def __init__(self, counter: int | StatsCounter, value: int):
+        self.counter = int(counter)
+        self.value = value
+
+
+class TraceCommand(Command):
+    """
+    One entry of the plane's flight recorder, $TRC + 2-digit event + 2-digit payload
+    + 4-digit timebase phase. See flightrecorder.py for the events.
+    """
+    SPEC = spec(b"TRC", "out")
+
+    event: int
+    payload: int
+    time: int
+
+    def __init__(self, event: int, payload: int, time: int):
+        self.event = event
+        self.payload = payload
+        self.time = time
 
 
 # ---------------- Simulator CMDs
 class LedCommand(Command):
-    MSG_ID = CommandID.LED_MSG_ID
+    SPEC = spec(b"LED", "in")
 
     led: int
 
     def __init__(self, led: int | LedValue):
         self.led = int(led)
 
-    def make_bytes(self):
-        return CMD_START_BYTE + CommandID.LED_MSG_ID + int2hexstring(self.led, 2) + CMD_END_BYTE
-
-    @classmethod
-    def _parse_bytes(cls, buffer: bytes):
-        button = hexstring2int(buffer[4:6])
-        return LedCommand(button)
-
 
 class ManualCommand(Command):
-    MSG_ID = CommandID.MANUAL_MSG_ID
+    SPEC = spec(b"MAN", "in")
 
     value: int
 
     def __init__(self, value: int):
         self.value = value
 
-    @classmethod
-    def _parse_bytes(cls, buffer: bytes):
-        # FIXME Ask Merve
-        value = hexstring2int(buffer[4:6])
-        return ManualCommand(value)
-
-    def make_bytes(self):
-        return CMD_START_BYTE + ManualCommand.MSG_ID + int2hexstring(self.value, 2) + CMD_END_BYTE
-
 
 class GoCommand(Command):
-    MSG_ID = CommandID.GO_MSG_ID
+    SPEC = spec(b"GOO", "in")
 
     total_distance: int
 
     def __init__(self, total_distance: int):
         self.total_distance = total_distance
 
-    def make_bytes(self):
-        return CMD_START_BYTE + GoCommand.MSG_ID + int2hexstring(self.total_distance) + CMD_END_BYTE
 
-    @classmethod
-    def _parse_bytes(cls, buffer: bytes):
-        total_distance = hexstring2int(buffer[4:8])
-        return GoCommand(total_distance)
+class EndCommand(Command):
+    SPEC = spec(b"END", "in")
 
 
-class EndCommand(Command):
-    MSG_ID = CommandID.END_MSG_ID
+class BinaryModeCommand(Command):
+    """
+    Handshake switching the plane to binary frames (value 1) or back to ASCII (value 0)
+    """
+    SPEC = spec(b"BIN", "in")
 
-    def make_bytes(self):
-        return CMD_START_BYTE + EndCommand.MSG_ID + CMD_END_BYTE
-    
-    @classmethod
-    def _parse_bytes(cls, buffer: bytes):
-        return EndCommand()
+    value: int
+
+    def __init__(self, value: int):
+        self.value = value
+
+
+class StatsQueryCommand(Command):
+    """
+    Asks the plane for all of its StatsCounter values, answered with one StatsCommand each
+    """
+    SPEC = spec(b"STA", "in")
+
+
+class TraceQueryCommand(Command):
+    """
+    Asks the plane to dump its flight recorder, answered with TraceCommands
+    """
+    SPEC = spec(b"TRC", "in")
 
 
 # ---------------- Both simulator and plane CMDS
 
 
 class AltitudeCommand(Command):
-    MSG_ID = CommandID.ALTITUDE_MSG_ID
+    """
+    Altitude period sent to the plane, or altitude reported by it
+    """
+    SPEC = spec(b"ALT", "in")
 
     altitude: int
 
     def __init__(self, altitude: int | AltitudePeriod):
         self.altitude = int(altitude)
 
-    @classmethod
-    def _parse_bytes(cls, buffer: bytes):
-        altitude = hexstring2int(buffer[4:8])
-        return AltitudeCommand(altitude)
 
-    def make_bytes(self):
-        return CMD_START_BYTE + AltitudeCommand.MSG_ID + int2hexstring(self.altitude) + CMD_END_BYTE
+# Class name of every MessageSpec to its class, fails on import if one is missing
+COMMAND_CLASSES = {s.class_name: globals()[s.class_name] for s in MESSAGES}
 
 
 # ---------------- Buffering CMD bytes
@@ -257,59 +326,85 @@ class AltitudeCommand(Command):
 
 class CMDBuffer:
     """
-    Buffer for building a command. It can only store one command at a time.
-    The command string must be parsed directly after it is completed.
+    Incremental frame scanner. Received data is appended to one reusable
+    bytearray with feed(), which returns every command completed by it and
+    keeps the unfinished tail for the next call. ASCII frames are located with
+    bytearray.find, binary frames are cut by the length their type implies.
     """
 
     def __init__(self):
-        self.reset()
-
-    def append(self, byte):
-        if len(byte) != 1:
-            logging.error(
-                f"CMDBuffer append got byte array of size {len(byte)}")
-            return False
-        # Check if buffer is in valid state
-        if self._is_command_string_built:
-            logging.error(
-                f"Byte received but the previously built command is not used! Undefined behaviour may occur")
-        # Check if command string has started
-        if len(self._buffer) == 0:
-            if byte == CMD_START_BYTE:
-                # Command string building is started now
-                self._buffer += byte
-                return True
+        self._buffer = bytearray()
+
+    def feed(self, data: bytes) -> list[Command]:
+        """
+        Appends received bytes and parses the frames completed by them.
+
+        Args:
+            data (bytes): Bytes read from the serial port
+
+        Returns:
+            list[Command]: Parsed commands in the order they were received
+        """
+        buffer = self._buffer
+        buffer += data
+        cmds = []
+        pos = 0
+        while True:
+            start = self._find_start(pos)
+            if start < 0:
+                # Nothing but noise left
+                pos = len(buffer)
+                break
+            if buffer[start] == BINARY_SYNC_INT:
+                end = self._binary_end(start)
+                if end == 0:
+                    # Unknown type, the sync byte was noise
+                    pos = start + 1
+                    continue
             else:
-                # Ignore, we expected a CMD_START_BYTE here
-                return False
-        if byte == CMD_START_BYTE:
-            logging.warning(
-                f"CMD_START_BYTE received before receiving CMD_END_BYTE")
-            # Dispose old bytes
-            self._buffer = CMD_START_BYTE
-            return True
-        elif byte == CMD_END_BYTE:
-            # Command string building has finished
-            self._buffer += byte
-            self._is_command_string_built = True
-            return True
-        else:
-            # Just a normal byte, extend
-            self._buffer += byte
-            return True
-
-    def is_command_string_built(self):
-        return self._is_command_string_built
-
-    def parse_command(self):
-        if not self._is_command_string_built:
-            return None
-        # Parse and return a command
-        cmd = Command.parse_bytes(self._buffer)
-        logging.debug(f"CMDBuffer parsed {cmd}")
-        self.reset()
-        return cmd
+                end = buffer.find(CMD_END_BYTE, start + 1) + 1
+                restart = buffer.find(CMD_START_BYTE, start + 1, end if end else len(buffer))
+                if restart >= 0:
+                    logging.warning(
+                        f"CMD_START_BYTE received before receiving CMD_END_BYTE")
+                    # Dispose old bytes
+                    pos = restart
+                    continue
+            if end <= 0 or end > len(buffer):
+                # Frame is not complete yet
+                pos = start
+                break
+            frame = bytes(buffer[start:end])
+            if frame[0] == BINARY_SYNC_INT:
+                cmd = Command.parse_binary(frame)
+            else:
+                cmd = Command.parse_bytes(frame)
+            logging.debug(f"CMDBuffer parsed {cmd}")
+            if cmd:
+                cmds.append(cmd)
+            pos = end
+        del buffer[:pos]
+        return cmds
+
+    def _find_start(self, pos):
+        ascii_start = self._buffer.find(CMD_START_BYTE, pos)
+        binary_start = self._buffer.find(BINARY_SYNC_BYTE, pos)
+        if ascii_start < 0 or (0 <= binary_start < ascii_start):
+            return binary_start
+        return ascii_start
+
+    def _binary_end(self, start):
+        """
+        Returns the end of the binary frame at start, -1 if its type has not been
+        received yet and 0 if the type is unknown.
+        """
+        if start + 1 >= len(self._buffer):
+            return -1
+        spec = BINARY_SPECS.get(self._buffer[start + 1])
+        if spec is None:
+            logging.warning(f"Binary frame of unknown type {self._buffer[start + 1]:#04x}")
+            return 0
+        return start + spec.payload_size + BINARY_OVERHEAD
 
     def reset(self):
-        self._is_command_string_built = False
-        self._buffer = b""
+        self._buffer.clear()
@@ -1,7 +1,7 @@
 import logging
 from queue import Empty, Queue
 from cmds import Command
-import time
+from clock import now
 
 
 class CommandQueue(Queue):
@@ -13,12 +13,16 @@ class CommandQueue(Queue):
         self.get_timeout = get_timeout
         self.queue = Queue()
         self.start_time = 0
+        self.analyzer = None    # e.g. a CadenceAnalyzer, sees every queued command
         
     def set_start_time(self, start_time: float):
         self.start_time = start_time
     
+    def set_analyzer(self, analyzer):
+        self.analyzer = analyzer
+
     def get_current_relative_timestamp(self):
-        return time.time() - self.start_time
+        return now() - self.start_time
     
     def get(self) -> tuple[float, Command]:
         """
@@ -34,6 +38,15 @@ class CommandQueue(Queue):
             logging.error(f"Command queue could not get an item in given timeout of {self.get_timeout} seconds.")
             return None
 
+    def get_nowait(self) -> tuple[float, Command]:
+        """
+        Returns a timestamp and command, or None if the queue is empty.
+        """
+        try:
+            return self.queue.get_nowait()
+        except Empty:
+            return None
+
     def put(self, cmd: Command, timestamp: float = None):
         """
         Puts a command in the queue with a timestamp relative to the GO command sent by the server.
@@ -45,4 +58,6 @@ class CommandQueue(Queue):
         """
         if timestamp == None:
             timestamp = self.get_current_relative_timestamp()
+        if self.analyzer:
+            self.analyzer.record(timestamp, cmd)
         self.queue.put((timestamp, cmd))
@@ -0,0 +1,168 @@
+#!/usr/bin/env python
+"""
+Decoder of the plane's flight recorder. $TRC# makes the firmware freeze its
+trace ring and stream it back as TraceCommands: a DUMP header carrying the
+timebase parameters, the entries oldest first and a DUMP_END trailer with their
+count. TraceDecoder collects them and turns a complete dump into a timeline.
+
+Every entry is stamped with the timebase phase, the timer counts since the last
+timebase event. timer_isr() records an entry (TIMEBASE or TICK) on every
+timebase event, so absolute time is rebuilt by starting the next event when the
+phase goes backwards, or at a second timebase entry of the same event (the host
+build fires the events of a tick at once). This only holds while the timebase
+runs, i.e. between GO and END.
+
+Usage: python flightrecorder.py [FILE]  decodes the $TRC frames of a capture (stdin by default)
+"""
+import logging
+import sys
+from dataclasses import dataclass
+from enum import IntEnum
+
+from cmds import CMDBuffer, TraceCommand
+
+logger = logging.getLogger("flightrecorder")
+
+
+class TraceEvent(IntEnum):
+    """
+    Event ids of the firmware's TraceEvent
+    """
+    DUMP = 0x00
+    DUMP_END = 0x01
+    RX = 0x02
+    TX_DONE = 0x03
+    ADC_START = 0x04
+    TIMEBASE = 0x05
+    TICK = 0x06
+    TELEMETRY = 0x07
+    RX_DROP = 0x08
+    TX_DROP = 0x09
+    MESSAGE = 0x40  # + MessageType
+    SEND = 0x60     # + OutMessageType
+
+
+# Headers in the order of the firmware's MessageType and OutMessageType
+MESSAGE_NAMES = ["GOO", "END", "SPD", "ALT", "MAN", "LED", "BIN", "STA", "TRC"]
+SEND_NAMES = ["DST", "ALT", "PRS", "STA", "TRC"]
+
+
+@dataclass
+class TraceEntry:
+    event: int
+    payload: int
+    phase: int      # timer counts since the timebase event it happened after
+    time_us: float  # since the timebase event before the oldest entry
+
+    def name(self) -> str:
+        if TraceEvent.SEND <= self.event < TraceEvent.SEND + len(SEND_NAMES):
+            return "send " + SEND_NAMES[self.event - TraceEvent.SEND]
+        if TraceEvent.MESSAGE <= self.event < TraceEvent.MESSAGE + len(MESSAGE_NAMES):
+            return "message " + MESSAGE_NAMES[self.event - TraceEvent.MESSAGE]
+        try:
+            return TraceEvent(self.event).name.lower()
+        except ValueError:
+            return f"event 0x{self.event:02X}"
+
+    def details(self) -> str:
+        p = self.payload
+        if self.event == TraceEvent.RX:
+            return repr(chr(p)) if 0x20 <= p < 0x7F else f"0x{p:02X}"
+        if self.event == TraceEvent.TELEMETRY:
+            return f"counter={p >> 4} altitude_period={p & 0xF}"
+        if self.event == TraceEvent.TICK:
+            return f"ticks_posted={p}"
+        if self.event == TraceEvent.TIMEBASE:
+            return f"timebase_events={p}"
+        if self.event == TraceEvent.ADC_START:
+            return f"altitude_period={p}"
+        if self.event == TraceEvent.RX_DROP:
+            return f"buffer={p}"
+        if self.event == TraceEvent.TX_DROP:
+            return f"length={p}"
+        if self.event >= TraceEvent.MESSAGE:
+            return f"value=0x..{p:02X}"
+        return ""
+
+
+def decode(commands: list[TraceCommand], events_per_tick: int, event_counts: int,
+           tick_period: float) -> list[TraceEntry]:
+    """
+    Rebuilds the time of the dumped entries, in microseconds from the timebase
+    event before the oldest one
+    """
+    event_us = tick_period * 1e6 / max(events_per_tick, 1)
+    count_us = event_us / max(event_counts, 1)
+    entries = []
+    epoch, last_phase, timebase_seen = 0, 0, False
+    for cmd in commands:
+        is_timebase = cmd.event in (TraceEvent.TIMEBASE, TraceEvent.TICK)
+        if cmd.time < last_phase or (is_timebase and timebase_seen):
+            epoch += 1
+            timebase_seen = False
+        timebase_seen = timebase_seen or is_timebase
+        last_phase = cmd.time
+        entries.append(TraceEntry(cmd.event, cmd.payload, cmd.time, epoch * event_us + cmd.time * count_us))
+    return entries
+
+
+def format_timeline(entries: list[TraceEntry]) -> str:
+    lines = [f"{'#':>4} {'time ms':>10} {'delta us':>9} {'phase':>6}  event"]
+    previous = None
+    for idx, entry in enumerate(entries):
+        delta = "" if previous is None else f"{entry.time_us - previous:.0f}"
+        lines.append(f"{idx:>4} {entry.time_us / 1000:>10.3f} {delta:>9} {entry.phase:>6}  " +
+                     f"{entry.name():<12} {entry.details()}".rstrip())
+        previous = entry.time_us
+    return "\n".join(lines)
+
+
+class TraceDecoder:
+    """
+    Collects the TraceCommands of dumps as they arrive. feed() returns the
+    decoded entries once a dump's trailer is received, None before that.
+    """
+
+    def __init__(self, tick_period: float):
+        self.tick_period = tick_period
+        self.dumps = 0
+        self._commands: list[TraceCommand] | None = None
+        self._events_per_tick = 0
+        self._event_counts = 0
+
+    def feed(self, cmd: TraceCommand) -> list[TraceEntry] | None:
+        if cmd.event == TraceEvent.DUMP:
+            self._commands = []
+            self._events_per_tick = cmd.payload
+            self._event_counts = cmd.time
+            return None
+        if self._commands is None:
+            logger.warning(f"Trace entry {cmd.event:02X} received outside of a dump")
+            return None
+        if cmd.event != TraceEvent.DUMP_END:
+            self._commands.append(cmd)
+            return None
+
+        commands, self._commands = self._commands, None
+        if len(commands) != cmd.payload:
+            logger.warning(f"Trace dump has {len(commands)} entries, the plane sent {cmd.payload}")
+        self.dumps += 1
+        return decode(commands, self._events_per_tick, self._event_counts, self.tick_period)
+
+
+def main():
+    logging.basicConfig(level=logging.INFO)
+    source = open(sys.argv[1], "rb") if len(sys.argv) > 1 else sys.stdin.buffer
+    buffer, decoder = CMDBuffer(), TraceDecoder(0.1)
+    with source:
+        for cmd in buffer.feed(source.read()):
+            if isinstance(cmd, TraceCommand):
+                entries = decoder.feed(cmd)
+                if entries is not None:
+                    print(format_timeline(entries))
+    if decoder.dumps == 0:
+        logger.warning("No complete trace dump found")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,33 @@
+class Histogram:
+    """
+    Fixed-width bucket histogram. Values past the last bucket are counted in
+    it, the exact maximum is kept aside.
+    """
+
+    def __init__(self, bucket_width: float, bucket_count: int):
+        self.bucket_width = bucket_width
+        self.buckets = [0] * bucket_count
+        self.count = 0
+        self.max = None
+
+    def add(self, value: float):
+        idx = min(max(int(value / self.bucket_width), 0), len(self.buckets) - 1)
+        self.buckets[idx] += 1
+        self.count += 1
+        if self.max is None or value > self.max:
+            self.max = value
+
+    def percentile(self, p: float) -> float:
+        """
+        Returns the upper edge of the bucket holding the p-th percentile (0-100),
+        or None if nothing was added.
+        """
+        if self.count == 0:
+            return None
+        rank = p / 100 * self.count
+        seen = 0
+        for idx, n in enumerate(self.buckets):
+            seen += n
+            if seen >= rank and n > 0:
+                return min((idx + 1) * self.bucket_width, self.max)
+        return self.max
@@ -0,0 +1,72 @@
+# Generated by protocol/generate.py from protocol/messages.json, do not edit
+from enum import IntEnum
+from typing import NamedTuple
+
+BINARY_SYNC = 0xA5
+BINARY_OVERHEAD = 3  # sync, type and CRC bytes
+
+
+class BinaryType(IntEnum):
+    """
+    Type bytes of the binary frames. Commands sent to the plane are numbered from
+    0x10 in the order of the firmware's MessageType, its reports from 0x20 in the
+    order of OutMessageType.
+    """
+    GO = 0x10
+    END = 0x11
+    SPEED = 0x12
+    ALTITUDE = 0x13
+    MANUAL = 0x14
+    LED = 0x15
+    BINARY = 0x16
+    STATS = 0x17
+    TRACE = 0x18
+    DISTANCE_REPORT = 0x20
+    ALTITUDE_REPORT = 0x21
+    PRESS_REPORT = 0x22
+    STATS_REPORT = 0x23
+    TRACE_REPORT = 0x24
+
+
+class MessageSpec(NamedTuple):
+    """
+    One message of the protocol. fields are (attribute, hex digits) pairs, most
+    significant first; in a binary frame they are one little-endian number.
+    """
+    msg_id: bytes
+    direction: str  # "in" is sent to the plane, "out" by it
+    binary_type: int
+    fields: tuple
+    class_name: str  # Command subclass in cmds.py
+
+    @property
+    def digits(self) -> int:
+        return sum(d for _, d in self.fields)
+
+    @property
+    def payload_size(self) -> int:
+        return self.digits // 2
+
+
+# In the order of MessageType, then OutMessageType
+MESSAGES = (
+    MessageSpec(b"GOO", "in", 0x10, (("total_distance", 4),), "GoCommand"),
+    MessageSpec(b"END", "in", 0x11, (), "EndCommand"),
+    MessageSpec(b"SPD", "in", 0x12, (("speed", 4),), "SpeedCommand"),
+    MessageSpec(b"ALT", "in", 0x13, (("altitude", 4),), "AltitudeCommand"),
+    MessageSpec(b"MAN", "in", 0x14, (("value", 2),), "ManualCommand"),
+    MessageSpec(b"LED", "in", 0x15, (("led", 2),), "LedCommand"),
+    MessageSpec(b"BIN", "in", 0x16, (("value", 2),), "BinaryModeCommand"),
+    MessageSpec(b"STA", "in", 0x17, (), "StatsQueryCommand"),
+    MessageSpec(b"TRC", "in", 0x18, (), "TraceQueryCommand"),
+    MessageSpec(b"DST", "out", 0x20, (("distance", 4),), "DistanceCommand"),
+    MessageSpec(b"ALT", "out", 0x21, (("altitude", 4),), "AltitudeCommand"),
+    MessageSpec(b"PRS", "out", 0x22, (("button", 2),), "PressCommand"),
+    MessageSpec(b"STA", "out", 0x23, (("counter", 2), ("value", 4)), "StatsCommand"),
+    MessageSpec(b"TRC", "out", 0x24, (("event", 2), ("payload", 2), ("time", 4)), "TraceCommand"),
+)
+
+# (MSG ID, digit count) to spec, the same ID may be used with different digits
+ASCII_SPECS = {(spec.msg_id, spec.digits): spec for spec in MESSAGES}
+# Binary type byte to spec
+BINARY_SPECS = {spec.binary_type: spec for spec in MESSAGES}
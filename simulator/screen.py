@@ -9,6 +9,9 @@ from ui.drawable import *
 DISPLAY_WIDTH = 640*2
 DISPLAY_HEIGHT = 480*2
 FPS = 24
+SKY_HEIGHT = 300
+SKY_COLOR = (0x88, 0xc2, 0xf6)
+GROUND_COLOR = (0xd4, 0xef, 0xff)
 
 class StatusValue(str, Enum):
     NORMAL = "NORMAL"
@@ -31,6 +34,8 @@ class Screen:
         self._keyboard_handlers = []
         # UI
         self.visualizer: AutopilotVisualizer = None
+        # Set from other threads, the status line is drawn again by the UI thread
+        self._status_dirty = True
 
     def add_keyboard_handler(self, handler):
         self._keyboard_handlers.append(handler)
@@ -56,6 +61,7 @@ class Screen:
 
     def _set_status_text(self, text: str, color: tuple[int, int, int]):
         self.status_text = Text((0, 0), text, color, self.status_text_font)
+        self._status_dirty = True
 
     def set_status_text(self, status: StatusValue):
         if status == StatusValue.NORMAL:
@@ -71,13 +77,21 @@ class Screen:
 
         self.visualizer = AutopilotVisualizer(
             (0, 70), Screen.ALTITUDES, DISPLAY_WIDTH)
+        visualizer_rect = self.visualizer.get_rect(Transform(0, 0))
+        status_y = AutopilotVisualizer.DEFAULT_HEIGHT + 100
+        status_rect = pygame.Rect(0, status_y, DISPLAY_WIDTH, self.status_text_label.get_height())
+
+        # The background is filled once, after that only the rectangles that
+        # changed are drawn and passed to display.update()
+        self.screen.fill(SKY_COLOR, pygame.Rect(0, 0, DISPLAY_WIDTH, SKY_HEIGHT))
+        self.screen.fill(GROUND_COLOR, pygame.Rect(
+            0, SKY_HEIGHT, DISPLAY_WIDTH, DISPLAY_HEIGHT-SKY_HEIGHT))
+        pygame.display.update()
 
         while True:
-            self.screen.fill((0x88, 0xc2, 0xf6),
-                             pygame.Rect(0, 0, DISPLAY_WIDTH, 300))
-            self.screen.fill((0xd4, 0xef, 0xff), pygame.Rect(
-                0, 300, DISPLAY_WIDTH, DISPLAY_HEIGHT-300))
+            # The background strip scrolls, so the visualizer changes on every frame
             self.visualizer.draw(self.screen, Transform(0, 0))
+            dirty_rects = [visualizer_rect]
 
             # distance_text = font_footer.render(
             #     f"Last Reported Distance: {self._distance}", True, (0, 0, 0))
@@ -87,12 +101,17 @@ class Screen:
             # self.screen.blit(altitude_text, (320, 252))
 
             # Draw status texts
-            total_status_text_width = self.status_text_label.get_width() + self.status_text.get_width()
-            text_position_x = DISPLAY_WIDTH / 2 - total_status_text_width / 2
-            self.status_text_label.draw(self.screen, Transform(text_position_x, AutopilotVisualizer.DEFAULT_HEIGHT + 100))
-            self.status_text.draw(self.screen, Transform(text_position_x + self.status_text_label.get_width(), AutopilotVisualizer.DEFAULT_HEIGHT + 100))
-
-            pygame.display.update()
+            if self._status_dirty:
+                self._status_dirty = False
+                status_text = self.status_text
+                self.screen.fill(GROUND_COLOR, status_rect)
+                total_status_text_width = self.status_text_label.get_width() + status_text.get_width()
+                text_position_x = DISPLAY_WIDTH / 2 - total_status_text_width / 2
+                self.status_text_label.draw(self.screen, Transform(text_position_x, status_y))
+                status_text.draw(self.screen, Transform(text_position_x + self.status_text_label.get_width(), status_y))
+                dirty_rects.append(status_rect)
+
+            pygame.display.update(dirty_rects)
 
             for event in pygame.event.get():
                 if event.type == QUIT:
@@ -145,5 +164,30 @@ class Screen:
                 self.set_status_text(StatusValue.NORMAL)
 
 
+class HeadlessScreen:
+    """
+    Stands in for Screen when the simulator runs without a window. Accepts
+    the same calls and ignores them.
+    """
+
+    def add_keyboard_handler(self, handler):
+        pass
+
+    def start(self):
+        pass
+
+    def set_speed(self, speed: int):
+        pass
+
+    def set_altitude(self, altitude: int):
+        pass
+
+    def set_distance(self, distance: int):
+        pass
+
+    def update(self, update: object):
+        pass
+
+
 if __name__ == "__main__":
     Screen().update_loop()
@@ -0,0 +1,248 @@
+#!/usr/bin/env python
+"""
+Session recording of the serial line. Every byte AutoPilot writes to the plane
+or reads from it is appended to a binary log with the time it was seen, so a
+flight can be replayed later: into the agents (autopilot.py --replay), which
+then see the plane's frames at the same times and validate them again, or into
+a plane (python session.py LOG --port DEV), which gets the same input again.
+
+Layout, little-endian:
+    header  MAGIC, uint8 version, uint32 metadata length, metadata (JSON)
+    record  uint8 direction, uint32 microseconds since the previous record,
+            uint16 length, data
+Times count from the start of the recording, which AutoPilot opens right
+before GO, on the simulator's monotonic clock (virtual time for a virtual
+flight). A longer gap than a uint32 of microseconds is split by empty records.
+
+Usage: python session.py LOG                                  summarizes a recording
+       python session.py LOG --port DEV [--speed N] [--record PREFIX]
+                                sends the bytes recorded towards the plane to DEV,
+                                N times as fast (0: as fast as possible)
+"""
+import argparse
+import json
+import logging
+import struct
+import threading
+import time
+
+logger = logging.getLogger("session")
+
+MAGIC = b"APSN"
+VERSION = 1
+EXTENSION = ".session"
+HEADER = struct.Struct("<4sBI")
+RECORD = struct.Struct("<BIH")
+MAX_DELTA = 0xFFFFFFFF      # microseconds
+MAX_LENGTH = 0xFFFF
+
+# Directions of the records
+TO_PLANE = 0
+FROM_PLANE = 1
+
+
+class SessionRecorder:
+    """
+    Appends the traffic of one flight to <prefix>.session. record() is called
+    from the reader and the writer paths, which may be different threads.
+    """
+
+    def __init__(self, prefix: str, metadata: dict, clock):
+        self.path = prefix + EXTENSION
+        self.clock = clock
+        self.lock = threading.Lock()
+        self.file = open(self.path, "wb")
+        meta = json.dumps(metadata).encode()
+        self.file.write(HEADER.pack(MAGIC, VERSION, len(meta)) + meta)
+        self.last_us = int(clock.now() * 1e6)
+        self.records = 0
+
+    def record(self, direction: int, data: bytes):
+        with self.lock:
+            if self.file is None:
+                return
+            now_us = int(self.clock.now() * 1e6)
+            delta = max(now_us - self.last_us, 0)
+            self.last_us = now_us
+            while delta > MAX_DELTA:
+                self.file.write(RECORD.pack(direction, MAX_DELTA, 0))
+                delta -= MAX_DELTA
+            for start in range(0, max(len(data), 1), MAX_LENGTH):
+                chunk = data[start:start + MAX_LENGTH]
+                self.file.write(RECORD.pack(direction, delta, len(chunk)) + chunk)
+                delta = 0
+            self.records += 1
+
+    def close(self):
+        with self.lock:
+            if self.file is None:
+                return
+            self.file.close()
+            self.file = None
+        logger.info(f"Recorded {self.records} transfers to {self.path}")
+
+
+class Session:
+    """
+    A loaded recording. records are (seconds since the start, direction, data),
+    with the empty gap records left out.
+    """
+
+    def __init__(self, metadata: dict, records: list[tuple[float, int, bytes]]):
+        self.metadata = metadata
+        self.records = records
+
+    @property
+    def duration(self) -> float:
+        return self.records[-1][0] if self.records else 0.0
+
+    def data(self, direction: int) -> bytes:
+        return b"".join(data for _, d, data in self.records if d == direction)
+
+    def summary(self) -> str:
+        lines = [f"{len(self.records)} transfers over {self.duration:.3f} s, recorded with a " +
+                 f"{self.metadata.get('clock', '?')} clock" +
+                 (", binary frames" if self.metadata.get("binary_frames") else "")]
+        for direction, name in ((TO_PLANE, "to the plane"), (FROM_PLANE, "from the plane")):
+            count = sum(1 for _, d, _ in self.records if d == direction)
+            lines.append(f"{name:<15} {count:>7} transfers {len(self.data(direction)):>9} bytes")
+        return "\n".join(lines)
+
+
+def load_session(path: str) -> Session:
+    with open(path, "rb") as f:
+        raw = f.read()
+    magic, version, meta_length = HEADER.unpack_from(raw)
+    if magic != MAGIC or version != VERSION:
+        raise ValueError(f"{path} is not a version {VERSION} session recording")
+    pos = HEADER.size
+    metadata = json.loads(raw[pos:pos + meta_length])
+    pos += meta_length
+    records = []
+    now_us = 0
+    while pos + RECORD.size <= len(raw):
+        direction, delta, length = RECORD.unpack_from(raw, pos)
+        pos += RECORD.size
+        now_us += delta
+        if length:
+            records.append((now_us / 1e6, direction, raw[pos:pos + length]))
+            pos += length
+    if pos != len(raw):
+        # The recording was cut short, e.g. the simulator was killed
+        logger.warning(f"{path} ends with a partial record")
+    return Session(metadata, records)
+
+
+class ReplayPort:
+    """
+    Stands in for the serial port of AutoPilot in a replay: the bytes recorded
+    from the plane are passed to receiver at their recorded time after start(),
+    one record after the other on the clock, and what AutoPilot writes is kept
+    to be compared with the recorded writes.
+    """
+
+    def __init__(self, clock, session: Session, receiver=None):
+        self.clock = clock
+        self.receiver = receiver
+        self.timeout = None         # read like serial.Serial.timeout in log messages
+        self.incoming = [(t, data) for t, d, data in session.records if d == FROM_PLANE]
+        self.expected = session.data(TO_PLANE)
+        self.written = bytearray()
+        self.delivered = 0          # bytes passed to the receiver
+        self.start_time = 0
+        self.next = 0
+
+    def start(self, start_time: float):
+        self.start_time = start_time
+        self._schedule()
+
+    def _schedule(self):
+        if self.next < len(self.incoming):
+            self.clock.call_at(self.start_time + self.incoming[self.next][0], self._deliver)
+
+    def _deliver(self):
+        data = self.incoming[self.next][1]
+        self.next += 1
+        self.delivered += len(data)
+        self._schedule()
+        self.receiver(data)
+
+    def write(self, data: bytes):
+        self.written += data
+
+    def divergence(self) -> int | None:
+        """
+        Offset of the first byte written differently than in the recording,
+        None if the writes match it
+        """
+        for idx, (a, b) in enumerate(zip(self.written, self.expected)):
+            if a != b:
+                return idx
+        if len(self.written) != len(self.expected):
+            return min(len(self.written), len(self.expected))
+        return None
+
+
+def replay_to_port(session: Session, port: str, speed: float, record: str = None):
+    """
+    Sends the bytes recorded towards the plane to port, at their recorded times
+    divided by speed or back to back if speed is 0. What the plane answers is
+    counted, and recorded to <record>.session if given.
+    """
+    import serial
+    from clock import RealClock
+    line = serial.Serial(port, session.metadata.get("baudrate", 115200), timeout=0.1)
+    clock = RealClock()
+    recorder = None
+    if record:
+        recorder = SessionRecorder(record, dict(session.metadata, clock="real", replay_speed=speed), clock)
+    received = 0
+    alive = True
+
+    def reader():
+        nonlocal received
+        while alive:
+            data = line.read(max(1, line.in_waiting))
+            received += len(data)
+            if data and recorder:
+                recorder.record(FROM_PLANE, data)
+
+    reader_thread = threading.Thread(target=reader, daemon=True)
+    reader_thread.start()
+    sent = 0
+    start = time.monotonic()
+    for t, direction, data in session.records:
+        if direction != TO_PLANE:
+            continue
+        if speed > 0:
+            delay = start + t / speed - time.monotonic()
+            if delay > 0:
+                time.sleep(delay)
+        line.write(data)
+        if recorder:
+            recorder.record(TO_PLANE, data)
+        sent += len(data)
+    elapsed = time.monotonic() - start
+    # Let the plane answer the last commands
+    time.sleep(max(0.5, session.metadata.get("testcase", {}).get("period", 0.1) * 5))
+    alive = False
+    reader_thread.join()
+    if recorder:
+        recorder.close()
+    logger.info(f"Sent {sent} bytes in {elapsed:.3f} s ({session.duration / max(elapsed, 1e-9):.1f}x the " +
+                f"recorded {session.duration:.3f} s), received {received} bytes")
+
+
+if __name__ == "__main__":
+    logging.basicConfig(level=logging.INFO)
+    parser = argparse.ArgumentParser()
+    parser.add_argument("log", help="session recording, e.g. session.session")
+    parser.add_argument("--port", help="serial device to send the plane-bound bytes to, e.g. the pty of host/build/plane")
+    parser.add_argument("--speed", type=float, default=1.0,
+                        help="replay speed, 1 in recorded time, 0 as fast as possible")
+    parser.add_argument("--record", metavar="PREFIX", help="record the replay to PREFIX.session")
+    args = parser.parse_args()
+    recording = load_session(args.log)
+    print(recording.summary())
+    if args.port:
+        replay_to_port(recording, args.port, args.speed, args.record)
@@ -0,0 +1,301 @@
+#!/usr/bin/env python
+"""
+Test case compiler. A scenario (test-case-0.json) is expanded once into flat
+arrays indexed by period number, so the agents validate a period with one
+lookup instead of walking the scenario's events, and the result is cached
+next to the test case so that later runs skip the parsing as well.
+
+Period p is inside a time window (enter, exit) of the scenario when its end,
+p * period + period-offset, is. This is when PeriodicityAgent closes it. An
+altitude control also owns the period right after its window: the ALT 0 it
+sends on exit reaches the plane during that period, which may still bring the
+ALT frame that was due.
+
+Usage: python testcase.py [test case ...]  compiles (or loads) and summarizes
+"""
+import hashlib
+import json
+import logging
+import os
+import pickle
+import re
+import sys
+from array import array
+
+logger = logging.getLogger("testcase")
+
+# Bump when the compiled layout or its meaning changes, invalidates the caches
+COMPILER_VERSION = 3
+CACHE_DIR = ".testcase-cache"
+
+# Values of CompiledTestCase.altitude
+ANY_ALTITUDE = -1       # an ALT frame is expected, its value does not matter
+FREQ_PENDING = -2       # the frequency was changed at the end of the previous period
+NO_ALTITUDE = -32768    # no ALT frame is expected
+
+# Controller and LED defaults
+NO_CONTROLLER = -1
+NO_COMMAND = -1
+DEFAULT_LED_TIMEOUT = 3  # seconds, as LedAgent
+
+# Distance DistanceAgent sends in the SPD command of every period
+DISTANCE_PER_PERIOD = 10
+
+
+def load_testcase(path: str) -> dict:
+    """
+    Parses a test case, dropping the lines with // comments
+    """
+    with open(path, 'r') as f:
+        lines = f.readlines()
+        lines = [line for line in lines if not re.search(r'//', line)]
+        return json.loads("\n".join(lines))
+
+
+class CompiledTestCase:
+    """
+    Period-indexed expectations of a test case. Every array has one entry per
+    period of the flight; periods past the end read as outside of every window.
+
+    altitude            expected altitude, ANY_ALTITUDE, FREQ_PENDING or NO_ALTITUDE
+    controller          index of the altitude control active in the period, or NO_CONTROLLER
+    zone                altitude zone of that control the period belongs to, -1 before the first
+    altitude_command    period (ms) to send in an ALT command when the period ends, or NO_COMMAND
+    leds                bit i set while the press of the i-th entry of manual.leds is
+                        awaited; several LEDs, or the same one twice, may overlap
+
+    led_numbers is the LED (1-4) of every entry of manual.leds.
+    """
+
+    def __init__(self, config: dict, periods: int):
+        self.config = config
+        self.periods = periods
+        self.altitude = array('i', [NO_ALTITUDE]) * periods
+        self.controller = array('b', [NO_CONTROLLER]) * periods
+        self.zone = array('h', [-1]) * periods
+        self.altitude_command = array('h', [NO_COMMAND]) * periods
+        self.leds = [0] * periods
+        self.led_numbers = [led["button"] for led in config.get("manual", {}).get("leds", [])]
+
+    def flight_time(self) -> float:
+        """
+        Seconds covered by the arrays
+        """
+        return self.periods * self.config["period"]
+
+    def controller_at(self, period_no: int) -> int:
+        return self.controller[period_no] if 0 <= period_no < self.periods else NO_CONTROLLER
+
+    def expected_altitude(self, period_no: int) -> int | None:
+        """
+        None if no ALT frame is expected in the period
+        """
+        if 0 <= period_no < self.periods and self.altitude[period_no] != NO_ALTITUDE:
+            return self.altitude[period_no]
+        return None
+
+    def zone_at(self, period_no: int) -> int:
+        return self.zone[period_no] if 0 <= period_no < self.periods else -1
+
+    def command_at(self, period_no: int) -> int | None:
+        if 0 <= period_no < self.periods and self.altitude_command[period_no] != NO_COMMAND:
+            return self.altitude_command[period_no]
+        return None
+
+    def altitude_targets(self) -> list[int | None]:
+        """
+        The altitude to fly at for the ALT frame of every period: the next value
+        an altitude control expects, None after the last one
+        """
+        targets, target = [None] * self.periods, None
+        for p in reversed(range(self.periods)):
+            if self.altitude[p] >= 0:
+                target = self.altitude[p]
+            targets[p] = target
+        return targets
+
+    def led_at(self, period_no: int, entry: int) -> bool:
+        """
+        True if the press of the LED of manual.leds[entry] is awaited in the period
+        """
+        return 0 <= period_no < self.periods and bool(self.leds[period_no] >> entry & 1)
+
+    def leds_awaited(self, period_no: int, below: int | None = None) -> set[int]:
+        """
+        LEDs whose press is awaited in the period, only of the entries before
+        manual.leds[below] if given
+        """
+        mask = self.leds[period_no] if 0 <= period_no < self.periods else 0
+        if below is not None:
+            mask &= (1 << below) - 1
+        return {led for entry, led in enumerate(self.led_numbers) if mask >> entry & 1}
+
+    def summary(self) -> str:
+        controlled = sum(1 for c in self.controller if c != NO_CONTROLLER)
+        altitudes = sum(1 for a in self.altitude if a != NO_ALTITUDE)
+        led = sum(1 for v in self.leds if v)
+        overlapping = sum(1 for v in self.leds if v & (v - 1))
+        return (f"{self.periods} periods: {controlled} under altitude control with {altitudes} ALT frames " +
+                f"expected, {led} awaiting a button ({overlapping} more than one)")
+
+
+def compile_testcase(config: dict) -> CompiledTestCase:
+    period = config["period"]
+    offset = config["period-offset"]
+
+    def window(enter: float, exit: float):
+        """
+        Periods whose end lies in (enter, exit)
+        """
+        first = max(0, int((enter - offset) / period) - 1)
+        p = first
+        while p * period + offset <= enter:
+            p += 1
+        while p * period + offset < exit:
+            yield p
+            p += 1
+
+    # DistanceAgent flies DISTANCE_PER_PERIOD every period, the windows may reach further
+    ends = [config["total-distance"] // DISTANCE_PER_PERIOD + 2]
+    for control in config.get("altitude-controls", []):
+        ends.append(int(control["exit"] / period) + 2)
+    manual = config.get("manual")
+    led_timeout = config.get("led-timeout", DEFAULT_LED_TIMEOUT)
+    if manual:
+        ends.append(int(manual["manual-exit"] / period) + 2)
+        for led in manual["leds"]:
+            ends.append(int((led["start-time"] + led_timeout) / period) + 2)
+    compiled = CompiledTestCase(config, max(ends))
+
+    trailing = [_compile_altitude_control(compiled, idx, control, list(window(control["enter"], control["exit"])))
+                for idx, control in enumerate(config.get("altitude-controls", []))]
+    for idx, (p, expected, zone) in enumerate(trailing):
+        # Unless the next control has taken the period over already
+        if 0 <= p < compiled.periods and compiled.controller[p] == NO_CONTROLLER:
+            compiled.controller[p] = idx
+            compiled.altitude[p] = expected
+            compiled.zone[p] = zone
+    if manual:
+        for entry, led in enumerate(manual["leds"]):
+            for p in window(led["start-time"], led["start-time"] + led_timeout):
+                compiled.leds[p] |= 1 << entry
+    return compiled
+
+
+def _compile_altitude_control(compiled: CompiledTestCase, idx: int, control: dict,
+                              periods: list[int]) -> tuple[int, int, int]:
+    """
+    Runs the events of an altitude control through the periods it is active
+    in: "freq" sends a new altitude period, "free" expects ALT frames of any
+    value and "altitude" frames of the given value, each for "count" periods.
+    The expectation of a period is set when the previous one ends. Returns the
+    period after the window with its expected altitude and zone.
+    """
+    period = compiled.config["period"]
+    events = control["events"]
+    event_idx, progress = 0, 0
+    last_freq, last_freq_period = 0, -1
+    zone = -1
+    expected = NO_ALTITUDE
+
+    def next_expected(next_period_no: int, altitude: int) -> int:
+        if last_freq == 0:
+            return NO_ALTITUDE
+        # Distance of two expected altitude commands in period counts
+        period_count = round(last_freq / 1000 / period * 10) / 10
+        if (next_period_no - last_freq_period) % period_count == 0:
+            return altitude
+        return NO_ALTITUDE
+
+    for p in periods:
+        if compiled.controller[p] != NO_CONTROLLER:
+            logger.critical(f"Altitude controls {compiled.controller[p]} and {idx} overlap at period {p}")
+        compiled.controller[p] = idx
+        compiled.altitude[p] = expected
+        compiled.zone[p] = zone
+        if event_idx == len(events):
+            expected = next_expected(p + 1, ANY_ALTITUDE)
+            continue
+        event = events[event_idx]
+        if event["type"] == "freq":
+            compiled.altitude_command[p] = event["value"]
+            last_freq, last_freq_period = event["value"], p
+            event_idx += 1
+            expected = next_expected(p + 1, FREQ_PENDING)
+        elif event["type"] == "free":
+            progress += 1
+            if progress == event["count"]:
+                event_idx += 1
+                progress = 0
+            expected = next_expected(p + 1, ANY_ALTITUDE)
+        elif event["type"] == "altitude":
+            if progress == 0:
+                # A new altitude zone starts
+                zone += 1
+            if last_freq == 0:
+                logger.critical(f"Altitude control {idx} expects altitude {event['value']} at period {p} " +
+                                "before a non-zero freq event. Make sure your test case is valid.")
+            expected = next_expected(p + 1, event["value"])
+            progress += 1
+            if progress == event["count"]:
+                event_idx += 1
+                progress = 0
+        else:
+            logger.critical(f"Altitude control {idx} has an unknown event type {event['type']}")
+            event_idx += 1
+    if event_idx < len(events):
+        logger.warning(f"Altitude control {idx} has {len(events) - event_idx} events left when it exits")
+    return (periods[-1] + 1 if periods else -1), expected, zone
+
+
+def load_compiled(path: str) -> CompiledTestCase:
+    """
+    Compiles the test case at path, or loads it from the cache if the file has
+    not changed since it was compiled
+    """
+    with open(path, "rb") as f:
+        source = f.read()
+    digest = hashlib.sha256(source + str(COMPILER_VERSION).encode()).hexdigest()[:16]
+    stem = os.path.splitext(os.path.basename(path))[0]
+    cache_dir = os.path.join(os.path.dirname(os.path.abspath(path)), CACHE_DIR)
+    cache_path = os.path.join(cache_dir, f"{stem}-{digest}.pickle")
+    try:
+        with open(cache_path, "rb") as f:
+            return pickle.load(f)
+    except (OSError, pickle.UnpicklingError, EOFError, AttributeError):
+        pass
+
+    compiled = compile_testcase(load_testcase(path))
+    try:
+        os.makedirs(cache_dir, exist_ok=True)
+        tmp_path = f"{cache_path}.{os.getpid()}"
+        with open(tmp_path, "wb") as f:
+            pickle.dump(compiled, f, pickle.HIGHEST_PROTOCOL)
+        os.replace(tmp_path, cache_path)
+    except OSError as ex:
+        logger.warning(f"Compiled test case could not be cached: {ex}")
+    else:
+        prune_cache(cache_dir, stem, os.path.basename(cache_path))
+    return compiled
+
+
+def prune_cache(cache_dir: str, stem: str, keep: str):
+    """
+    Removes the older compilations of a test case from the cache, they are never
+    loaded again once the file or the compiler has changed
+    """
+    stale = re.compile(re.escape(stem) + r"-[0-9a-f]{16}\.pickle")
+    for name in os.listdir(cache_dir):
+        if stale.fullmatch(name) and name != keep:
+            try:
+                os.remove(os.path.join(cache_dir, name))
+            except FileNotFoundError:
+                pass    # removed by another run of the same test case
+
+
+if __name__ == "__main__":
+    # Through the module, so that the cache pickles testcase.CompiledTestCase and not __main__'s
+    import testcase
+    logging.basicConfig(level=logging.INFO)
+    for path in sys.argv[1:] or ["test-case-0.json"]:
+        print(f"{path}: {testcase.load_compiled(path).summary()}")
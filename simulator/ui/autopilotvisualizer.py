@@ -28,6 +28,8 @@ class AltitudeZone(Drawable):
         # The parts of the area the zone will fill in
         self.screen_rect = screen_rect
         self.color = AltitudeZone.NEUTRAL_COLOR
+        # The rounded rectangle, rendered again only when size or color changes
+        self.canvas: pygame.Surface = None
 
     def calculate_screen_position_in_period(self, curr_period_no: int, screen_length: int):
         """
@@ -51,10 +53,11 @@ class AltitudeZone(Drawable):
 
     def draw(self, surface: Surface, transform: Transform):
         if self.rect:
-            canvas = pygame.Surface(self.rect.size, pygame.SRCALPHA)
-            pygame.draw.rect(canvas, self.color,
-                             canvas.get_rect(), border_radius=AltitudeZone.BORDER_RADIUS)
-            surface.blit(canvas, transform.transform_rect(self.rect))
+            if self.canvas is None or self.canvas.get_size() != self.rect.size:
+                self.canvas = pygame.Surface(self.rect.size, pygame.SRCALPHA)
+                pygame.draw.rect(self.canvas, self.color,
+                                 self.canvas.get_rect(), border_radius=AltitudeZone.BORDER_RADIUS)
+            surface.blit(self.canvas, transform.transform_rect(self.rect))
 
     def set_state(self, state: AltitudeZoneState):
         if state == AltitudeZoneState.GOOD_STATE:
@@ -65,6 +68,7 @@ class AltitudeZone(Drawable):
             self.color = AltitudeZone.BAD_COLOR
         else:
             logger.critical(f"Unexpected altitude zone state: {state}")
+        self.canvas = None
 
     def update(self, curr_period_no: int, screen_length: int) -> bool:
         self.screen_positions = self.calculate_screen_position_in_period(
@@ -119,23 +123,21 @@ class SlidingBackground(Container):
             self.image, (self.image.get_width() * scale_factor, self.height))
 
     def draw(self, surface: pygame.Surface, transform: Transform):
-        super().draw(surface, transform)
-        # Draw on canvas, crop it, put it on the surface
+        # The image is opaque and covers the rectangle, so the contents are not drawn
         image_width = self.image.get_width()
         image_height = self.image.get_height()
-        repeat_count = ((self.width - 1)//image_width+2)
         if self.canvas == None:
+            # Tile the image once, one more time than fits, and crop it at the
+            # offset on every draw
+            repeat_count = ((self.width - 1)//image_width+2)
             self.canvas = pygame.Surface(
                 (repeat_count * image_width, image_height))
-        # Initially the start point of the left most image instance
-        x_offset = -self.offset
-        for i in range(repeat_count):
-            self.canvas.blit(self.image, (x_offset, 0))
-            x_offset += image_width
+            for i in range(repeat_count):
+                self.canvas.blit(self.image, (i * image_width, 0))
         # Put it on the surface now
         transform = transform.combine(self.transform)
         surface.blit(self.canvas, (transform.x, transform.y),
-                     pygame.Rect(0, 0, self.width, self.height))
+                     pygame.Rect(self.offset, 0, self.width, self.height))
 
     def update_offset(self):
         self.offset = (self.offset + self.speed) % self.image.get_width()
@@ -159,9 +161,13 @@ class AutopilotVisualizer(Container):
         determines z-order of the content.
 
         Its contents are in the following order:
-        - self.container contains the SlidingBackground and altitude lines / texts.
-        - self.altitude_zone_container contains altitude zones
-        - self.plane, which is always the top most drawable.
+        - self.container contains the SlidingBackground, self.static_layer and
+          self.plane.
+        - self.static_layer caches the altitude lines / texts, which never move.
+        - self.altitude_zone_container contains altitude zones.
+
+        Everything is inside get_rect(), and the background scrolls on every
+        draw, so that rectangle is the only part of the screen it changes.
         """
         super().__init__(position)
         self.width = width
@@ -182,6 +188,8 @@ class AutopilotVisualizer(Container):
         self.sliding_bgr = SlidingBackground(
             (0, 0), SlidingBackground.DEFAULT_IMG_PATH, self.width, self.height)
         self.container.add_content(self.sliding_bgr)
+        self.static_layer = CachedContainer((0, 0), (self.width, self.height))
+        self.container.add_content(self.static_layer)
         self._add_altitude_lines_and_text()
         self._make_altitude_zone_regions()
         # Add altitude zones container
@@ -198,10 +206,10 @@ class AutopilotVisualizer(Container):
             self.altitude_texts.append(
                 Text((self.width - AutopilotVisualizer.PADDING, i*self.line_offset_y), f"{str(self.altitudes[i-1])}", (0, 0, 0), self.font))
             self.altitude_texts[-1].set_anchor(1, 0.5)
-            self.add_content(self.altitude_texts[-1])
+            self.static_layer.add_content(self.altitude_texts[-1])
             dashed_line = DashedLine((AutopilotVisualizer.PADDING, i*self.line_offset_y),
                                      (self.sliding_bgr.width - 70, i*self.line_offset_y), AutopilotVisualizer.DEFAULT_LINE_COLOR)
-            self.container.add_content(dashed_line)
+            self.static_layer.add_content(dashed_line)
 
     def _make_altitude_zone_regions(self):
         # Calculate altitude zone maximal screen regions
@@ -216,6 +224,13 @@ class AutopilotVisualizer(Container):
         self.sliding_bgr.update_offset()
         return super().draw(surface, transform)
 
+    def get_rect(self, transform: Transform) -> pygame.Rect:
+        """
+        Returns the screen area draw() covers with the given transform
+        """
+        return transform.combine(self.transform).transform_rect(
+            pygame.Rect(0, 0, self.width, self.height))
+
     def update(self, curr_period_no: int):
         for z in self.altitude_zone_container.contents:
             z: AltitudeZone
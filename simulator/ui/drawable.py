@@ -99,6 +99,34 @@ class Container(Drawable):
             content.draw(surface, transform.combine(self.transform))
 
 
+class CachedContainer(Container):
+    """
+    Container whose contents do not change between frames. They are rendered
+    once into a transparent surface of the given size, and every draw is a
+    single blit of it. Call invalidate() after changing the contents.
+    """
+
+    def __init__(self, position: tuple[float, float], size: tuple[int, int]):
+        super().__init__(position)
+        self.size = size
+        self.cache: pygame.Surface = None
+
+    def add_content(self, content):
+        super().add_content(content)
+        self.invalidate()
+
+    def invalidate(self):
+        self.cache = None
+
+    def draw(self, surface: pygame.Surface, transform: Transform):
+        if self.cache is None:
+            self.cache = pygame.Surface(self.size, pygame.SRCALPHA)
+            for content in self.contents:
+                content.draw(self.cache, Transform(0, 0))
+        surface.blit(self.cache, transform.transform_point(
+            (self.transform.x, self.transform.y)))
+
+
 class Line(Drawable):
     def __init__(self, start_pos: tuple[float, float], end_pos: tuple[float, float], color, width=1):
         super().__init__()
@@ -124,6 +152,7 @@ class DashedLine(Line):
         self.dash_length = dash_length
 
     def draw(self, surface: pygame.Surface, transform: Transform):
+        # Drawn dash by dash, put it in a CachedContainer if it does not move
         # Mostly ChatGPT
         x1, y1 = transform.transform_point(self.start_pos)
         x2, y2 = transform.transform_point(self.end_pos)
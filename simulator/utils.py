@@ -34,3 +34,26 @@ def hexstring2int(hex: str | bytes) -> int:
     except ValueError as ex:
         logger.error(f"hexstring2int got ValueError: {repr(ex)}")
         return -1
+
+# CRC-8 with polynomial 0x07 and initial value 0, as used by the binary frames
+CRC8_TABLE = []
+for _value in range(256):
+    _crc = _value
+    for _ in range(8):
+        _crc = ((_crc << 1) ^ 0x07) & 0xFF if _crc & 0x80 else (_crc << 1) & 0xFF
+    CRC8_TABLE.append(_crc)
+
+def crc8(data: bytes) -> int:
+    """
+    Returns the CRC-8 of the data.
+
+    Args:
+        data (bytes): Bytes to checksum
+
+    Returns:
+        int: CRC-8 value
+    """
+    crc = 0
+    for byte in data:
+        crc = CRC8_TABLE[crc ^ byte]
+    return crc
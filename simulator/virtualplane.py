@@ -0,0 +1,149 @@
+import ctypes
+import logging
+import os
+
+logger = logging.getLogger("virtualplane")
+
+DEFAULT_LIBRARY = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                               "..", "host", "build", "libfirmware.so")
+TX_CHUNK_SIZE = 4096
+
+# adc_to_alt() of the firmware: 9000 + 1000 per band of 256 ADC counts
+ALTITUDE_BASE = 9000
+ALTITUDE_STEP = 1000
+ADC_BAND = 256
+
+PRESS_DELAY = 0.5   # seconds from the LED to the press of its button
+PRESS_TIME = 0.2    # seconds the button is held, two ticks of debounce samples
+
+
+def altitude_to_adc(altitude: int) -> int:
+    """
+    The middle of the ADC band the firmware reports as altitude
+    """
+    return (altitude - ALTITUDE_BASE) // ALTITUDE_STEP * ADC_BAND + ADC_BAND // 2
+
+
+class VirtualPlane:
+    """
+    Runs the firmware's host build (make host) in virtual time and stands in for
+    the serial port of AutoPilot. Nothing is simulated by hand: main.c's own
+    receive_isr(), parse(), timer_isr() and telemetry_task() run on every event.
+
+    Both directions of the line are modelled at the given baudrate with 10 bits
+    per byte. A write is delivered to the firmware when its last byte has been
+    shifted in, and frames sent by the firmware reach the receiver when their
+    last byte is out. The 100 ms tick comes from the firmware's timebase model,
+    and the ADC input starts at the given level.
+
+    Every instance runs its own board of the library, so several planes can fly
+    side by side on one clock.
+
+    Bytes are delivered with the timebase counter set to the time since the
+    last tick, so the flight recorder stamps them as the device would. While the
+    firmware has work pending after a main loop iteration (a flight recorder
+    dump), the device would not sleep, so the loop runs again once the line is free.
+
+    fly() plays the pilot's part of the test case after GO: the ADC follows the
+    altitudes the altitude controls expect and the button of every LED of the
+    manual window is pressed, so a correct firmware flies the test case clean.
+    """
+
+    def __init__(self, clock, baudrate: int, receiver=None, adc: int = 512,
+                 tick: float = 0.1, library: str = DEFAULT_LIBRARY):
+        self.clock = clock
+        self.receiver = receiver    # called with the received bytes
+        self.byte_time = 10 / baudrate
+        self.tick = tick
+        self.timeout = None         # read like serial.Serial.timeout in log messages
+        self.rx_free_at = 0         # the line towards the firmware is busy until
+        self.tx_free_at = 0         # the line from the firmware is busy until
+        self._tx_buffer = ctypes.create_string_buffer(TX_CHUNK_SIZE)
+
+        self.lib = ctypes.CDLL(library)
+        self.lib.host_board_new.restype = ctypes.c_void_p
+        self.lib.host_select.argtypes = [ctypes.c_void_p]
+        self.lib.host_uart_tx_take.restype = ctypes.c_size_t
+        self.lib.host_uart_tx_take.argtypes = [ctypes.c_char_p, ctypes.c_size_t]
+        self.lib.host_uart_rx.argtypes = [ctypes.c_uint8]
+        self.lib.host_adc_set_input.argtypes = [ctypes.c_uint16]
+        self.lib.host_portb_write.argtypes = [ctypes.c_uint8]
+        self.lib.host_timer_phase_us.argtypes = [ctypes.c_ulong]
+        self.lib.host_events_pending.restype = ctypes.c_uint8
+        self.last_tick = self.clock.now()
+        self._service_pending = False
+        self.buttons = 0            # RB4-RB7 held down, bit 0 is RB4
+        self.board = self.lib.host_board_new()
+        self.lib.host_select(self.board)
+        self.lib.host_boot()
+        self.lib.host_adc_set_input(adc)
+        self.clock.call_at(self.clock.now() + tick, self._on_tick)
+
+    def fly(self, compiled, go_time: float):
+        """
+        Schedules the ADC levels and button presses of the compiled test case,
+        with go_time the time GO was written
+        """
+        period = compiled.config["period"]
+        level = None
+        for period_no, altitude in enumerate(compiled.altitude_targets()):
+            if altitude is None or altitude_to_adc(altitude) == level:
+                continue
+            level = altitude_to_adc(altitude)
+            # A sample is averaged into the ALT frames of the later ticks, so the
+            # level of the frame in period p is sampled from the tick of p - 1 on
+            at = max(self.clock.now(), go_time + (period_no - 1.5) * period)
+            self.clock.call_at(at, self._set_adc, level)
+        for led in compiled.config.get("manual", {}).get("leds", []):
+            at = go_time + led["start-time"] + PRESS_DELAY
+            self.clock.call_at(at, self._press, led["button"] - 1, True)
+            self.clock.call_at(at + PRESS_TIME, self._press, led["button"] - 1, False)
+
+    def _set_adc(self, level: int):
+        self.lib.host_select(self.board)
+        self.lib.host_adc_set_input(level)
+
+    def _press(self, bit: int, down: bool):
+        self.buttons = self.buttons | (1 << bit) if down else self.buttons & ~(1 << bit)
+        self.lib.host_select(self.board)
+        self.lib.host_portb_write(self.buttons)
+
+    def write(self, data: bytes):
+        start = max(self.clock.now(), self.rx_free_at)
+        self.rx_free_at = start + len(data) * self.byte_time
+        self.clock.call_at(self.rx_free_at, self._on_rx, bytes(data))
+
+    def _on_rx(self, data: bytes):
+        self.lib.host_select(self.board)
+        self.lib.host_timer_phase_us(int((self.clock.now() - self.last_tick) * 1e6))
+        for byte in data:
+            self.lib.host_uart_rx(byte)
+        self._service()
+
+    def _on_tick(self):
+        self.lib.host_select(self.board)
+        self.last_tick = self.clock.now()
+        self.lib.host_timer_tick()
+        self.lib.host_adc_step()
+        self._service()
+        self.clock.call_at(self.clock.now() + self.tick, self._on_tick)
+
+    def _service(self):
+        # One main loop iteration, then let transmit_isr() drain OUTBUF
+        self.lib.host_service_tasks()
+        self.lib.host_service_interrupts()
+        n = self.lib.host_uart_tx_take(self._tx_buffer, TX_CHUNK_SIZE)
+        if n > 0:
+            start = max(self.clock.now(), self.tx_free_at)
+            self.tx_free_at = start + n * self.byte_time
+            if self.receiver:
+                self.clock.call_at(self.tx_free_at, self.receiver, self._tx_buffer.raw[:n])
+        if self.lib.host_events_pending() and not self._service_pending:
+            self._service_pending = True
+            self.clock.call_at(max(self.clock.now(), self.tx_free_at), self._on_busy)
+
+    def _on_busy(self):
+        self._service_pending = False
+        self.lib.host_select(self.board)
+        self.lib.host_timer_phase_us(int((self.clock.now() - self.last_tick) * 1e6))
+        self._service()
@@ -0,0 +1,206 @@
+#!/usr/bin/env python
+"""
+RAM and flash report of an XC8 build against tools/memory-budget.json.
+
+The totals come from the memoryfile.xml the linker writes next to the image
+(--memorysummary), the rest from its map file:
+
+    RAM per symbol    the symbol table gives each variable its psect and
+                      address; a variable extends to the next symbol of its
+                      psect or the psect's end. The compiled stack of the
+                      function autos and parameters is one row per psect.
+    flash per symbol  the code size of every function, from the module
+                      information at the end of the map
+
+The budget may set a "program" and a "data" total in bytes, tighter than the
+device's; a total it leaves out is checked against the device's length from
+memoryfile.xml. "symbols" is a byte limit per symbol name (e.g. "_aircraft").
+Anything over its budget is marked and makes the report exit with 1.
+
+Usage: python memreport.py [--conf CONF] [--image production|debug]
+                           [--map MAP --memoryfile XML] [--budget JSON] [--top N]
+Without --map, the newest map under dist/ (of CONF if given) is reported.
+"""
+import argparse
+import glob
+import json
+import os
+import re
+import sys
+import xml.etree.ElementTree as ElementTree
+
+ROOT = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..")
+DEFAULT_BUDGET = os.path.join(os.path.dirname(os.path.abspath(__file__)), "memory-budget.json")
+
+DATA_SPACE = 1
+# Name Link Load Length Selector Space [Scale], one line per psect of every object file
+PSECT_LINE = re.compile(r"^\s+(\S+)\s+([0-9A-F]+)\s+[0-9A-F]+\s+([0-9A-F]+)\s+[0-9A-F]+\s+(\d+)(?:\s+\d+)?\s*$")
+# Name Psect Value of the symbol table
+SYMBOL_LINE = re.compile(r"^(\S+)\s+(\S+)\s+([0-9A-F]+)\s*$")
+# Function Class Link Load Size of the module information, the size is decimal
+FUNCTION_LINE = re.compile(r"^\s+(\S+)\s+CODE\s+[0-9A-F]+\s+[0-9A-F]+\s+(\d+)\s*$")
+
+
+class Psect:
+    def __init__(self, name: str, link: int, length: int, space: int):
+        self.name = name
+        self.link = link
+        self.length = length
+        self.space = space
+
+    @property
+    def end(self) -> int:
+        return self.link + self.length
+
+
+def parse_map(path: str) -> tuple[dict[str, Psect], list[tuple[str, str, int]], list[tuple[str, int]]]:
+    """
+    Returns the psects by name, the symbols as (name, psect, address) and the
+    functions as (name, code bytes)
+    """
+    psects, symbols, functions = {}, [], []
+    section = None
+    with open(path, errors="replace") as f:
+        for line in f:
+            stripped = line.strip()
+            if stripped.startswith("TOTAL") or stripped.startswith("SEGMENTS"):
+                section = None
+            elif stripped == "Symbol Table":
+                section = "symbols"
+                continue
+            elif stripped.startswith("FUNCTION INFORMATION"):
+                section = None
+            elif stripped == "MODULE INFORMATION":
+                section = "modules"
+                continue
+            elif stripped.startswith("Name") and "Selector" in stripped and not psects:
+                section = "psects"
+                continue
+
+            if section == "psects":
+                m = PSECT_LINE.match(line)
+                if m:
+                    name, link, length, space = m.groups()
+                    psects[name] = Psect(name, int(link, 16), int(length, 16), int(space))
+            elif section == "symbols":
+                m = SYMBOL_LINE.match(line)
+                if m and m.group(2) != "(abs)":
+                    symbols.append((m.group(1), m.group(2), int(m.group(3), 16)))
+            elif section == "modules":
+                m = FUNCTION_LINE.match(line)
+                if m:
+                    functions.append((m.group(1), int(m.group(2))))
+    return psects, symbols, functions
+
+
+def ram_symbols(psects: dict[str, Psect], symbols: list[tuple[str, str, int]]) -> list[tuple[str, str, int]]:
+    """
+    Returns (name, psect, bytes) of every variable in data space
+    """
+    rows = []
+    by_psect = {}
+    for name, psect, address in symbols:
+        p = psects.get(psect)
+        if p is None or p.space != DATA_SPACE or p.length == 0:
+            continue
+        if psect.startswith("cstack") or name.startswith("__"):
+            # Autos are reported as the whole stack, __L/__H/__size_of are the linker's
+            continue
+        by_psect.setdefault(psect, []).append((address, name))
+    for psect, entries in by_psect.items():
+        entries.sort()
+        ends = [address for address, _ in entries[1:]] + [psects[psect].end]
+        for (address, name), end in zip(entries, ends):
+            if end > address:
+                rows.append((name, psect, end - address))
+    for p in psects.values():
+        if p.space == DATA_SPACE and p.name.startswith("cstack") and p.length:
+            rows.append(("(compiled stack)", p.name, p.length))
+    return rows
+
+
+def memory_summary(path: str) -> dict[str, tuple[int, int]]:
+    """
+    Returns {"program": (used, length), "data": (used, length)} in bytes
+    """
+    summary = {}
+    for memory in ElementTree.parse(path).getroot().iter("memory"):
+        summary[memory.get("name")] = (int(memory.findtext("used")), int(memory.findtext("length")))
+    return summary
+
+
+def find_build(conf: str | None, image: str | None) -> str:
+    pattern = os.path.join(ROOT, "dist", conf or "*", image or "*", "*.map")
+    maps = glob.glob(pattern)
+    if not maps:
+        raise FileNotFoundError(f"No map file matches {os.path.relpath(pattern, ROOT)}, build the firmware first")
+    return max(maps, key=os.path.getmtime)
+
+
+def check(used: int, budget: int | None) -> str:
+    if budget is None:
+        return ""
+    return f"{budget:>7}" + ("  OVER" if used > budget else "")
+
+
+def report(map_path: str, memoryfile: str, budget: dict, top: int) -> int:
+    """
+    Prints the report and returns the number of budgets exceeded
+    """
+    psects, symbols, functions = parse_map(map_path)
+    limits = budget.get("symbols", {})
+    over = 0
+    print(f"{os.path.relpath(map_path, ROOT)}")
+    if os.path.exists(memoryfile):
+        for name, (used, length) in memory_summary(memoryfile).items():
+            limit = budget.get(name, length)
+            over += used > limit
+            print(f"{name:<10} {used:>7} of {length:>7} bytes  {check(used, limit)}")
+    else:
+        print(f"{os.path.relpath(memoryfile, ROOT)} is missing, no totals")
+
+    ram = sorted(ram_symbols(psects, symbols), key=lambda row: -row[2])
+    print(f"\n{'RAM':<32} {'psect':<14} {'bytes':>7}  {'budget':>7}")
+    for idx, (name, psect, size) in enumerate(ram):
+        limit = limits.get(name)
+        over += limit is not None and size > limit
+        if idx < top or (limit is not None and size > limit):
+            print(f"{name:<32} {psect:<14} {size:>7}  {check(size, limit)}")
+    print(f"{'total':<32} {'':<14} {sum(size for _, _, size in ram):>7}")
+
+    code = sorted(functions, key=lambda row: -row[1])
+    print(f"\n{'flash':<32} {'':<14} {'bytes':>7}  {'budget':>7}")
+    for idx, (name, size) in enumerate(code):
+        limit = limits.get(name)
+        over += limit is not None and size > limit
+        if idx < top or (limit is not None and size > limit):
+            print(f"{name:<32} {'':<14} {size:>7}  {check(size, limit)}")
+    print(f"{'total':<32} {'':<14} {sum(size for _, size in code):>7}")
+    return over
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--conf", help="MPLAB configuration, e.g. Simulate or UploadWithPickit3")
+    parser.add_argument("--image", choices=["production", "debug"], help="image type of the build")
+    parser.add_argument("--map", help="map file to report instead of the newest build's")
+    parser.add_argument("--memoryfile", help="memory summary of the build, memoryfile.xml next to the map by default")
+    parser.add_argument("--budget", default=DEFAULT_BUDGET, help="budget to check against")
+    parser.add_argument("--top", type=int, default=20, help="symbols listed per table, the ones over budget always are")
+    args = parser.parse_args()
+    try:
+        map_path = args.map or find_build(args.conf, args.image)
+    except FileNotFoundError as ex:
+        print(ex)
+        sys.exit(1)
+    memoryfile = args.memoryfile or os.path.join(os.path.dirname(map_path), "memoryfile.xml")
+    with open(args.budget) as f:
+        budget = json.load(f)
+    over = report(map_path, memoryfile, budget, args.top)
+    if over:
+        print(f"\n{over} over budget")
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()